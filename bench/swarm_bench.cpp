@@ -0,0 +1,471 @@
+// Loopback swarm benchmark for the aura binary.
+//
+// Starts a bootstrap node, N seeders and M leechers on 127.0.0.1 with
+// distinct ports, shares a generated file from every seeder and downloads it
+// on every leecher. Reports aggregate throughput, completion time and time to
+// first byte percentiles, and CPU time and peak RSS per process. Exits with a
+// non-zero status unless every leecher finished with an identical copy.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Seeders announce five seconds after start (see main.cpp); allow for slow boxes
+const std::chrono::seconds ANNOUNCE_TIMEOUT{15};
+// Time for the announcements to reach the bootstrap node before leechers look up
+const std::chrono::milliseconds ANNOUNCE_SETTLE{1000};
+
+struct Options {
+    std::string binary;
+    size_t seeders = 1;
+    size_t leechers = 4;
+    uint64_t file_size = 64ull * 1024 * 1024;
+    int base_port = 9400;
+    int timeout = 120; // Seconds allowed for all leechers to finish
+    std::string workdir; // Created under /tmp when empty
+    bool keep = false;
+    std::vector<std::string> seed_args;
+    std::vector<std::string> leech_args;
+};
+
+struct Process {
+    std::string name;
+    fs::path dir;
+    pid_t pid = -1;
+    int out_fd = -1; // Child stdout and stderr
+    std::ofstream log;
+    std::string partial_line;
+    Clock::time_point started;
+    bool exited = false;
+    int status = 0;
+    struct rusage usage {};
+
+    // Milestones parsed from the output, in seconds since start
+    std::string file_hash;
+    std::optional<double> first_chunk;
+    std::optional<double> completed;
+};
+
+double seconds_since(Clock::time_point start, Clock::time_point now) {
+    return std::chrono::duration<double>(now - start).count();
+}
+
+std::vector<std::string> split_args(const std::string& args) {
+    std::istringstream in(args);
+    std::vector<std::string> out;
+    std::string arg;
+    while (in >> arg) {
+        out.push_back(arg);
+    }
+    return out;
+}
+
+std::string default_binary() {
+    std::error_code ec;
+    fs::path self = fs::read_symlink("/proc/self/exe", ec);
+    return ec ? "./aura" : (self.parent_path() / "aura").string();
+}
+
+void usage(const char* argv0) {
+    std::cout << "Usage: " << argv0 << " [--binary <path>] [--seeders <n>] [--leechers <n>] [--size-mb <n>]"
+              << " [--base-port <port>] [--timeout <seconds>] [--workdir <dir>] [--keep]"
+              << " [--seed-args \"<args>\"] [--leech-args \"<args>\"]" << std::endl;
+}
+
+bool spawn(Process& proc, const std::string& binary, const std::vector<std::string>& args) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::cerr << "pipe: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    proc.log.open(proc.dir / "output.log");
+    proc.started = Clock::now();
+    proc.pid = fork();
+    if (proc.pid < 0) {
+        std::cerr << "fork: " << std::strerror(errno) << std::endl;
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (proc.pid == 0) {
+        if (chdir(proc.dir.c_str()) != 0) {
+            _exit(127);
+        }
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(binary.c_str()));
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(binary.c_str(), argv.data());
+        _exit(127);
+    }
+    close(fds[1]);
+    proc.out_fd = fds[0];
+    fcntl(proc.out_fd, F_SETFL, fcntl(proc.out_fd, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+void on_line(Process& proc, const std::string& line, Clock::time_point now) {
+    proc.log << line << '\n';
+    const std::string hash_marker = "with hash ";
+    auto pos = line.find(hash_marker);
+    if (pos != std::string::npos && proc.file_hash.empty()) {
+        std::istringstream in(line.substr(pos + hash_marker.size()));
+        in >> proc.file_hash;
+    }
+    if (line.find("[Download] First chunk verified") != std::string::npos && !proc.first_chunk) {
+        proc.first_chunk = seconds_since(proc.started, now);
+    }
+    if (line.find("[Download] Completed") != std::string::npos && !proc.completed) {
+        proc.completed = seconds_since(proc.started, now);
+    }
+}
+
+// Reads whatever the children printed, waiting at most timeout, and reaps exited ones
+void pump(std::vector<std::unique_ptr<Process>>& procs, std::chrono::milliseconds timeout) {
+    std::vector<pollfd> fds;
+    std::vector<Process*> owners;
+    for (auto& proc : procs) {
+        if (proc->out_fd >= 0) {
+            fds.push_back({proc->out_fd, POLLIN, 0});
+            owners.push_back(proc.get());
+        }
+    }
+    if (!fds.empty()) {
+        poll(fds.data(), fds.size(), static_cast<int>(timeout.count()));
+    } else {
+        std::this_thread::sleep_for(timeout);
+    }
+
+    auto now = Clock::now();
+    char buffer[16 * 1024];
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+            continue;
+        }
+        Process& proc = *owners[i];
+        ssize_t n;
+        while ((n = read(proc.out_fd, buffer, sizeof(buffer))) > 0) {
+            proc.partial_line.append(buffer, static_cast<size_t>(n));
+            size_t newline;
+            while ((newline = proc.partial_line.find('\n')) != std::string::npos) {
+                on_line(proc, proc.partial_line.substr(0, newline), now);
+                proc.partial_line.erase(0, newline + 1);
+            }
+        }
+        if (n == 0) {
+            close(proc.out_fd);
+            proc.out_fd = -1;
+        }
+    }
+
+    for (auto& proc : procs) {
+        if (!proc->exited && proc->pid > 0 && wait4(proc->pid, &proc->status, WNOHANG, &proc->usage) == proc->pid) {
+            proc->exited = true;
+        }
+    }
+}
+
+void stop_all(std::vector<std::unique_ptr<Process>>& procs) {
+    for (auto& proc : procs) {
+        if (!proc->exited && proc->pid > 0) {
+            kill(proc->pid, SIGTERM);
+        }
+    }
+    for (auto& proc : procs) {
+        if (!proc->exited && proc->pid > 0) {
+            wait4(proc->pid, &proc->status, 0, &proc->usage);
+            proc->exited = true;
+        }
+        if (proc->out_fd >= 0) {
+            close(proc->out_fd);
+            proc->out_fd = -1;
+        }
+    }
+}
+
+bool generate_file(const fs::path& path, uint64_t size) {
+    std::ofstream out(path, std::ios::binary);
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> block(64 * 1024 / sizeof(uint64_t));
+    for (uint64_t written = 0; written < size;) {
+        for (auto& word : block) {
+            word = rng();
+        }
+        size_t n = static_cast<size_t>(std::min<uint64_t>(size - written, block.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(n));
+        written += n;
+    }
+    return static_cast<bool>(out);
+}
+
+bool same_contents(const fs::path& a, const fs::path& b) {
+    std::error_code ec;
+    if (!fs::exists(b, ec) || fs::file_size(a, ec) != fs::file_size(b, ec)) {
+        return false;
+    }
+    std::ifstream in_a(a, std::ios::binary);
+    std::ifstream in_b(b, std::ios::binary);
+    std::vector<char> buf_a(1 << 16);
+    std::vector<char> buf_b(1 << 16);
+    while (in_a && in_b) {
+        in_a.read(buf_a.data(), static_cast<std::streamsize>(buf_a.size()));
+        in_b.read(buf_b.data(), static_cast<std::streamsize>(buf_b.size()));
+        if (in_a.gcount() != in_b.gcount() ||
+            !std::equal(buf_a.begin(), buf_a.begin() + in_a.gcount(), buf_b.begin())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Nearest-rank percentile of a sorted sample
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * sorted.size() + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+void print_percentiles(const char* label, std::vector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    std::cout << std::left << std::setw(26) << label << std::right << std::fixed << std::setprecision(3);
+    if (samples.empty()) {
+        std::cout << "n/a" << std::endl;
+        return;
+    }
+    std::cout << "p50=" << percentile(samples, 50) << "s p90=" << percentile(samples, 90)
+              << "s p99=" << percentile(samples, 99) << "s max=" << samples.back() << "s" << std::endl;
+}
+
+double cpu_seconds(const timeval& tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    opt.binary = default_binary();
+    std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); ++i) {
+        bool has_value = i + 1 < args.size();
+        if (args[i] == "--binary" && has_value) {
+            opt.binary = args[++i];
+        } else if (args[i] == "--seeders" && has_value) {
+            opt.seeders = std::max<size_t>(1, std::stoul(args[++i]));
+        } else if (args[i] == "--leechers" && has_value) {
+            opt.leechers = std::max<size_t>(1, std::stoul(args[++i]));
+        } else if (args[i] == "--size-mb" && has_value) {
+            opt.file_size = static_cast<uint64_t>(std::stod(args[++i]) * 1024 * 1024);
+        } else if (args[i] == "--base-port" && has_value) {
+            opt.base_port = std::stoi(args[++i]);
+        } else if (args[i] == "--timeout" && has_value) {
+            opt.timeout = std::stoi(args[++i]);
+        } else if (args[i] == "--workdir" && has_value) {
+            opt.workdir = args[++i];
+        } else if (args[i] == "--keep") {
+            opt.keep = true;
+        } else if (args[i] == "--seed-args" && has_value) {
+            opt.seed_args = split_args(args[++i]);
+        } else if (args[i] == "--leech-args" && has_value) {
+            opt.leech_args = split_args(args[++i]);
+        } else {
+            usage(argv[0]);
+            return args[i] == "--help" ? 0 : 2;
+        }
+    }
+    if (access(opt.binary.c_str(), X_OK) != 0) {
+        std::cerr << "aura binary not found at " << opt.binary << " (use --binary)" << std::endl;
+        return 2;
+    }
+
+    fs::path workdir;
+    if (opt.workdir.empty()) {
+        char templ[] = "/tmp/aura-bench-XXXXXX";
+        if (!mkdtemp(templ)) {
+            std::cerr << "mkdtemp: " << std::strerror(errno) << std::endl;
+            return 2;
+        }
+        workdir = templ;
+    } else {
+        workdir = opt.workdir;
+        fs::create_directories(workdir);
+    }
+
+    fs::path source = workdir / "source.bin";
+    std::cout << "[Bench] Generating " << opt.file_size << " byte file in " << workdir << std::endl;
+    if (!generate_file(source, opt.file_size)) {
+        std::cerr << "Failed to write " << source << std::endl;
+        return 2;
+    }
+
+    std::vector<std::unique_ptr<Process>> procs;
+    auto add_process = [&](const std::string& name) -> Process& {
+        procs.push_back(std::make_unique<Process>());
+        Process& proc = *procs.back();
+        proc.name = name;
+        proc.dir = workdir / name;
+        fs::create_directories(proc.dir);
+        return proc;
+    };
+    std::string bootstrap = "127.0.0.1:" + std::to_string(opt.base_port);
+    bool ok = true;
+
+    Process& boot = add_process("bootstrap");
+    ok = spawn(boot, opt.binary, {"--port", std::to_string(opt.base_port)});
+    pump(procs, std::chrono::milliseconds(300));
+
+    // --- Seeders: each shares its own copy, so metadata files do not collide ---
+    std::vector<Process*> seeds;
+    for (size_t i = 0; ok && i < opt.seeders; ++i) {
+        Process& seed = add_process("seed" + std::to_string(i + 1));
+        fs::copy_file(source, seed.dir / "file.bin", fs::copy_options::overwrite_existing);
+        std::vector<std::string> seed_args = {"--port", std::to_string(opt.base_port + 1 + i),
+                                              "--bootstrap", bootstrap, "--share", "file.bin"};
+        seed_args.insert(seed_args.end(), opt.seed_args.begin(), opt.seed_args.end());
+        ok = spawn(seed, opt.binary, seed_args);
+        seeds.push_back(&seed);
+    }
+    auto deadline = Clock::now() + ANNOUNCE_TIMEOUT;
+    auto announced = [&]() {
+        return std::all_of(seeds.begin(), seeds.end(), [](Process* p) { return !p->file_hash.empty(); });
+    };
+    while (ok && !announced() && Clock::now() < deadline) {
+        pump(procs, std::chrono::milliseconds(100));
+    }
+    if (!ok || !announced()) {
+        std::cerr << "[Bench] Seeders did not announce the file in time, see " << workdir << std::endl;
+        stop_all(procs);
+        return 1;
+    }
+    std::string file_hash = seeds.front()->file_hash;
+    for (auto end = Clock::now() + ANNOUNCE_SETTLE; Clock::now() < end;) {
+        pump(procs, std::chrono::milliseconds(100));
+    }
+
+    // --- Leechers ---
+    std::vector<Process*> leeches;
+    for (size_t i = 0; ok && i < opt.leechers; ++i) {
+        Process& leech = add_process("leech" + std::to_string(i + 1));
+        std::vector<std::string> leech_args = {"--port", std::to_string(opt.base_port + 1 + opt.seeders + i),
+                                               "--bootstrap", bootstrap, "--download", file_hash,
+                                               "--exit-on-complete"};
+        leech_args.insert(leech_args.end(), opt.leech_args.begin(), opt.leech_args.end());
+        ok = spawn(leech, opt.binary, leech_args);
+        leeches.push_back(&leech);
+    }
+    deadline = Clock::now() + std::chrono::seconds(opt.timeout);
+    auto all_exited = [&]() {
+        return std::all_of(leeches.begin(), leeches.end(), [](Process* p) { return p->exited; });
+    };
+    while (ok && !all_exited() && Clock::now() < deadline) {
+        pump(procs, std::chrono::milliseconds(100));
+    }
+    bool timed_out = !all_exited();
+    stop_all(procs);
+
+    // --- Report ---
+    size_t completed = 0;
+    size_t verified = 0;
+    std::vector<double> completion;
+    std::vector<double> ttfb;
+    std::vector<double> transfer;
+    std::optional<Clock::time_point> first_byte;
+    std::optional<Clock::time_point> last_done;
+    for (auto* leech : leeches) {
+        if (leech->first_chunk) {
+            ttfb.push_back(*leech->first_chunk);
+            auto at = leech->started + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(*leech->first_chunk));
+            first_byte = first_byte ? std::min(*first_byte, at) : at;
+        }
+        if (!leech->completed) {
+            continue;
+        }
+        ++completed;
+        completion.push_back(*leech->completed);
+        if (leech->first_chunk) {
+            transfer.push_back(*leech->completed - *leech->first_chunk);
+        }
+        auto at = leech->started + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(*leech->completed));
+        last_done = last_done ? std::max(*last_done, at) : at;
+        if (same_contents(source, leech->dir / file_hash)) {
+            ++verified;
+        }
+    }
+
+    std::cout << std::endl;
+    std::cout << "Swarm: " << opt.seeders << " seeder(s), " << opt.leechers << " leecher(s), "
+              << std::fixed << std::setprecision(1) << opt.file_size / (1024.0 * 1024.0) << " MB file, hash "
+              << file_hash << std::endl;
+    std::cout << "Leechers completed: " << completed << "/" << opt.leechers << " (" << verified
+              << " identical)" << (timed_out ? ", timed out" : "") << std::endl;
+    if (first_byte && last_done && *last_done > *first_byte) {
+        double window = seconds_since(*first_byte, *last_done);
+        double mb = static_cast<double>(completed) * opt.file_size / (1024.0 * 1024.0);
+        std::cout << "Aggregate throughput: " << std::setprecision(1) << mb / window << " MB/s ("
+                  << mb << " MB in " << std::setprecision(3) << window
+                  << "s from the first verified chunk to the last completion)" << std::endl;
+    }
+    // Times are measured from process start and include the DHT lookup delay
+    print_percentiles("Completion time:", completion);
+    print_percentiles("Time to first byte:", ttfb);
+    print_percentiles("Transfer (TTFB->done):", transfer);
+
+    std::cout << std::endl << std::left << std::setw(12) << "process" << std::right << std::setw(10) << "user"
+              << std::setw(10) << "sys" << std::setw(12) << "max RSS" << "  exit" << std::endl;
+    for (auto& proc : procs) {
+        std::cout << std::left << std::setw(12) << proc->name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(9) << cpu_seconds(proc->usage.ru_utime) << "s"
+                  << std::setw(9) << cpu_seconds(proc->usage.ru_stime) << "s"
+                  << std::setw(9) << proc->usage.ru_maxrss / 1024 << " MB" << "  ";
+        if (WIFEXITED(proc->status)) {
+            std::cout << WEXITSTATUS(proc->status);
+        } else if (WIFSIGNALED(proc->status)) {
+            std::cout << "signal " << WTERMSIG(proc->status);
+        }
+        std::cout << std::endl;
+    }
+
+    // A temporary workdir is removed unless asked to keep it; --workdir is never deleted
+    if (opt.keep || !opt.workdir.empty()) {
+        std::cout << std::endl << "Logs and files kept in " << workdir << std::endl;
+    } else {
+        std::error_code ec;
+        fs::remove_all(workdir, ec);
+    }
+    return verified == opt.leechers ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <boost/asio/ip/address.hpp>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -12,6 +13,17 @@ namespace dht {
 std::string to_hex(const std::string& s);
 std::string from_hex(const std::string& hex_s);
 
+// --- Compact node entries (DHT message version 2) ---
+// id (20 bytes) + address (4 or 16 bytes) + port (2 bytes, big-endian)
+const size_t NODE_ID_SIZE = 20;
+const size_t COMPACT_IPV4_SIZE = NODE_ID_SIZE + 6;
+const size_t COMPACT_IPV6_SIZE = NODE_ID_SIZE + 18;
+
+std::string encode_compact_node(const std::string& id, const boost::asio::ip::address& address, uint16_t port);
+// Returns false for entries of the wrong size
+bool decode_compact_node(const std::string& entry, std::string& id,
+                         boost::asio::ip::address& address, uint16_t& port);
+
 // Calculates the XOR distance between two IDs
 inline std::vector<uint8_t> xor_distance(const std::string& id1, const std::string& id2) {
     std::vector<uint8_t> dist;
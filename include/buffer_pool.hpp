@@ -0,0 +1,96 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aura {
+
+// Size classes for pooled buffers. The largest one holds a framed SendChunk.
+const std::array<size_t, 4> BUFFER_SIZE_CLASSES = {512, 4 * 1024, 64 * 1024, 320 * 1024};
+// Idle buffers kept per size class; extra ones are freed on release
+const size_t BUFFER_POOL_MAX_IDLE = 64;
+
+// Allocation counters, exported through Node::log_stats
+struct AllocationStats {
+    uint64_t buffers_acquired = 0;
+    uint64_t buffers_reused = 0;     // Served from a free list
+    uint64_t buffers_allocated = 0;  // Fresh heap allocation for a size class
+    uint64_t buffers_oversize = 0;   // Larger than every class, never pooled
+    uint64_t buffers_freed = 0;      // Released while the free list was full
+    uint64_t messages_parsed = 0;    // Messages parsed into a reusable arena
+    uint64_t arena_bytes = 0;        // Arena space those messages used
+};
+
+class BufferPool;
+
+// Move-only handle to a pooled buffer; returns the storage on destruction
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    PooledBuffer(BufferPool* pool, std::vector<uint8_t>* storage, int size_class, size_t size)
+        : pool_(pool), storage_(storage), size_class_(size_class), size_(size) {}
+    PooledBuffer(PooledBuffer&& other) noexcept { *this = std::move(other); }
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer() { release(); }
+
+    uint8_t* data() { return storage_->data(); }
+    const uint8_t* data() const { return storage_->data(); }
+    size_t size() const { return size_; }
+
+private:
+    void release();
+
+    BufferPool* pool_ = nullptr;
+    std::vector<uint8_t>* storage_ = nullptr;
+    int size_class_ = -1; // -1: oversize, freed instead of pooled
+    size_t size_ = 0;
+};
+
+// A frame to send: pooled head bytes, then a payload shared with other sends
+// (a cached chunk) that goes out as a gather write instead of being copied
+struct OutgoingFrame {
+    PooledBuffer head;
+    std::shared_ptr<const void> payload_owner{};
+    const uint8_t* payload = nullptr;
+    size_t payload_size = 0;
+
+    size_t size() const { return head.size() + payload_size; }
+};
+
+// Process-wide pool of send buffers, recycled once a write completes
+class BufferPool {
+public:
+    static BufferPool& instance();
+
+    // Returns a buffer of exactly size bytes (capacity rounded up to its class)
+    PooledBuffer acquire(size_t size);
+
+    AllocationStats get_stats();
+    void record_arena_parse(size_t arena_bytes);
+
+private:
+    friend class PooledBuffer;
+    void release(std::vector<uint8_t>* storage, int size_class);
+
+    std::mutex mutex_;
+    std::array<std::vector<std::unique_ptr<std::vector<uint8_t>>>, BUFFER_SIZE_CLASSES.size()> free_lists_;
+    AllocationStats stats_;
+};
+
+// Arena options that start from a caller-owned block. Arena::Reset keeps that
+// block, so parsing a stream of small messages stops touching the heap.
+// The block must be 8-byte aligned.
+inline google::protobuf::ArenaOptions make_arena_options(char* block, size_t size) {
+    google::protobuf::ArenaOptions options;
+    options.initial_block = block;
+    options.initial_block_size = size;
+    return options;
+}
+
+} // namespace aura
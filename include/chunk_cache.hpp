@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace aura {
+
+// Default memory budget for cached chunk data
+const size_t DEFAULT_CHUNK_CACHE_BYTES = 64 * 1024 * 1024;
+// Frequency counters saturate here, as in TinyLFU's 4-bit counters
+const uint8_t SKETCH_MAX_COUNT = 15;
+// Counters are halved after this many samples per cacheable entry, so old
+// popularity fades
+const size_t SKETCH_SAMPLES_PER_ENTRY = 10;
+
+// A chunk read from disk, shared read-only by every session sending it
+using ChunkData = std::shared_ptr<const std::vector<uint8_t>>;
+
+struct ChunkCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t admitted = 0;
+    uint64_t rejected = 0;  // Candidates less popular than the entry they would evict
+    uint64_t evictions = 0;
+    size_t bytes = 0;
+    size_t entries = 0;
+};
+
+// Count-min sketch of recent access frequencies (four rows, saturating counters)
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t expected_entries);
+
+    void increment(size_t hash);
+    uint8_t estimate(size_t hash) const;
+
+private:
+    size_t index(size_t hash, int row) const;
+    void age();
+
+    std::vector<uint8_t> table_; // 4 rows of width_ counters
+    size_t width_;
+    size_t samples_ = 0;
+    size_t sample_limit_;
+};
+
+// Process-wide cache of chunk data keyed by (file hash, chunk index).
+// Recency decides the eviction victim; TinyLFU admission only lets a new
+// chunk in if it was requested more often than that victim, so one bulk
+// sequential read cannot flush chunks that a crowd keeps asking for.
+// Used from the io_context thread only.
+class ChunkCache {
+public:
+    explicit ChunkCache(size_t budget_bytes = DEFAULT_CHUNK_CACHE_BYTES);
+
+    // A zero budget disables the cache
+    void set_budget(size_t budget_bytes);
+    size_t get_budget() const { return budget_; }
+
+    static std::string make_key(const std::vector<uint8_t>& file_hash, uint32_t chunk_index);
+
+    // Counts the access; returns nullptr on a miss
+    ChunkData get(const std::string& key);
+    // Offers a chunk read after a miss; it may be rejected by admission
+    void put(const std::string& key, ChunkData data);
+
+    const ChunkCacheStats& get_stats() const { return stats_; }
+
+private:
+    struct Entry {
+        ChunkData data;
+        std::list<std::string>::iterator lru_it;
+    };
+
+    void evict_lru();
+
+    size_t budget_;
+    FrequencySketch sketch_;
+    std::list<std::string> lru_; // Most recently used first
+    std::unordered_map<std::string, Entry> entries_;
+    ChunkCacheStats stats_;
+};
+
+} // namespace aura
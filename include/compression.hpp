@@ -0,0 +1,75 @@
+#pragma once
+
+#include "chunk_cache.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace aura {
+
+// Chunks smaller than this are always sent raw
+const size_t COMPRESSION_MIN_SIZE = 1024;
+// Bytes compressed at the fastest level to decide whether a chunk is worth it
+const size_t COMPRESSION_SAMPLE_SIZE = 16 * 1024;
+// The sample must shrink below this fraction, otherwise the chunk is sent raw
+const double COMPRESSION_MAX_RATIO = 0.9;
+// Compressed chunks kept on the seeding side
+const size_t COMPRESSION_CACHE_ENTRIES = 64;
+// Compression workers; a level 9 pass over a chunk takes tens of milliseconds
+const size_t COMPRESSION_THREADS = 2;
+
+// Deflate (zlib) helpers. Both return false on failure.
+bool deflate_compress(const uint8_t* data, size_t len, int level, std::string& out);
+bool deflate_decompress(const std::string& in, size_t raw_size, std::string& out);
+
+// Compresses outgoing chunks on a worker pool and remembers the result, so a
+// hot chunk is compressed once rather than once per peer. Handlers and all
+// bookkeeping run on the io_context.
+class ChunkCompressor {
+public:
+    // Receives the compressed chunk, or nullptr if it should be sent raw
+    using CompressHandler = std::function<void(std::shared_ptr<const std::string> compressed)>;
+
+    explicit ChunkCompressor(boost::asio::io_context& io_context, size_t threads = COMPRESSION_THREADS);
+    ~ChunkCompressor();
+
+    // 0 disables compression, 1-9 are zlib levels
+    void set_level(int level);
+    int get_level() const { return level_; }
+
+    // Concurrent requests for one chunk share a single compression
+    void async_compress(const std::string& file_hash, uint32_t chunk_index, ChunkData data,
+                        CompressHandler handler);
+
+    uint64_t get_cache_hits() const { return cache_hits_; }
+    uint64_t get_skipped() const { return skipped_; }
+
+private:
+    using Key = std::string; // file_hash + chunk_index
+    struct Entry {
+        std::shared_ptr<const std::string> data; // nullptr: incompressible
+        std::list<Key>::iterator lru_it;
+    };
+
+    // Runs on a worker: probes a sample, then compresses the whole chunk
+    static std::shared_ptr<const std::string> compress(const std::vector<uint8_t>& data, int level);
+    void complete(const Key& key, std::shared_ptr<const std::string> result);
+
+    boost::asio::io_context& io_context_;
+    boost::asio::thread_pool pool_;
+    int level_ = 0;
+    std::list<Key> lru_; // Most recently used first
+    std::unordered_map<Key, Entry> cache_;
+    // Handlers waiting on a compression in progress
+    std::unordered_map<Key, std::vector<CompressHandler>> pending_;
+    uint64_t cache_hits_ = 0;
+    uint64_t skipped_ = 0;
+};
+
+} // namespace aura
@@ -0,0 +1,255 @@
+#pragma once
+
+#include "buffer_pool.hpp"
+#include <boost/asio.hpp>
+#include <openssl/evp.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace aura {
+
+using udp = boost::asio::ip::udp;
+
+// Random bytes each side contributes to the channel keys
+const size_t DATAGRAM_KEY_SHARE_SIZE = 32;
+// Payload bytes per data packet; a full packet stays well under 1280 bytes
+const size_t DATAGRAM_MSS = 1200;
+// Largest frame carried over a channel; a framed SendChunk fits
+const size_t DATAGRAM_MAX_FRAME_SIZE = 512 * 1024;
+// Receive buffer per channel, advertised to the sender as its window
+const size_t DATAGRAM_RECV_WINDOW = 4 * 1024 * 1024;
+// SACK blocks per ACK, lowest first
+const size_t DATAGRAM_MAX_SACK_BLOCKS = 8;
+// A segment counts as lost once this many later-sent segments are acknowledged
+const uint64_t DATAGRAM_DUP_THRESHOLD = 3;
+const std::chrono::milliseconds DATAGRAM_DELAYED_ACK{5};
+const std::chrono::milliseconds DATAGRAM_MIN_RTO{200};
+const std::chrono::milliseconds DATAGRAM_MAX_RTO{4000};
+// Reachability check after negotiation; chunks stay on TCP until it succeeds
+const std::chrono::milliseconds DATAGRAM_PROBE_INTERVAL{250};
+const int DATAGRAM_PROBE_ATTEMPTS = 8;
+// Unacknowledged data with no progress for this long fails the channel
+const std::chrono::seconds DATAGRAM_DEAD_TIMEOUT{15};
+const std::chrono::milliseconds DATAGRAM_TICK{5};
+
+// LEDBAT (RFC 6817): keep the queuing delay we add at about TARGET, so
+// bulk transfers yield to interactive traffic on a shared link
+const std::chrono::milliseconds LEDBAT_TARGET{100};
+const double LEDBAT_GAIN = 1.0;
+const size_t LEDBAT_MIN_CWND = 2 * DATAGRAM_MSS;
+const size_t LEDBAT_INIT_CWND = 4 * DATAGRAM_MSS;
+// cwnd may exceed the data actually in flight by this many segments
+const size_t LEDBAT_ALLOWED_INCREASE = 2;
+// Base delay: minimum one-way delay over the last 10 one-minute buckets
+const size_t LEDBAT_BASE_HISTORY = 10;
+// Current delay: minimum of the latest samples, which filters out jitter
+const size_t LEDBAT_CURRENT_FILTER = 4;
+
+struct DatagramStats {
+    uint64_t packets_sent = 0;
+    uint64_t packets_received = 0;
+    uint64_t packets_rejected = 0;  // Unknown connection or failed authentication
+    uint64_t packets_impaired = 0;  // Dropped by set_impairment
+    uint64_t retransmits = 0;
+};
+
+class DatagramChannel;
+
+// The node's UDP socket for chunk data. Peers negotiate a channel in the
+// Handshake (port, connection id, key share) and incoming packets are
+// routed to it by the connection id at their start.
+class DatagramTransport {
+public:
+    explicit DatagramTransport(boost::asio::io_context& io_context);
+
+    // Binds an ephemeral port; false (with a log line) on failure
+    bool start();
+    unsigned short get_port() const { return port_; }
+
+    std::shared_ptr<DatagramChannel> create_channel();
+
+    // Drops a fraction of outgoing packets and delays the rest, to try the
+    // transport on localhost where netem is not available
+    void set_impairment(double loss, std::chrono::milliseconds delay);
+
+    const DatagramStats& get_stats() const { return stats_; }
+
+private:
+    friend class DatagramChannel;
+
+    void do_receive();
+    void send(PooledBuffer packet, const udp::endpoint& target);
+    void release(uint32_t conn_id);
+    // Microseconds on a transport-wide clock, truncated to 32 bits
+    uint32_t timestamp() const;
+
+    boost::asio::io_context& io_context_;
+    udp::socket socket_;
+    unsigned short port_ = 0;
+    std::vector<uint8_t> recv_buffer_;
+    udp::endpoint recv_endpoint_;
+    std::unordered_map<uint32_t, std::weak_ptr<DatagramChannel>> channels_;
+    std::chrono::steady_clock::time_point epoch_;
+    std::mt19937 rng_;
+    double impair_loss_ = 0;
+    std::chrono::milliseconds impair_delay_{0};
+    DatagramStats stats_;
+};
+
+// Per-channel congestion state, for Node::log_stats
+struct DatagramChannelStats {
+    size_t cwnd = 0;
+    size_t bytes_in_flight = 0;
+    double srtt_ms = 0;
+    double queuing_delay_ms = 0;
+    uint64_t retransmits = 0;
+    uint64_t timeouts = 0;
+};
+
+// Reliable, ordered, encrypted frame channel to one peer. Packets are
+// sealed with AES-256-GCM, each direction under its own key derived from
+// the two key shares exchanged over TLS. Losses are repaired from
+// selective acknowledgements; the send rate follows LEDBAT.
+class DatagramChannel : public std::enable_shared_from_this<DatagramChannel> {
+public:
+    using FrameHandler = std::function<void(const uint8_t* body, size_t length)>;
+    using EventHandler = std::function<void()>;
+
+    DatagramChannel(DatagramTransport& transport, uint32_t conn_id, std::string key_share);
+    ~DatagramChannel();
+
+    uint32_t get_conn_id() const { return conn_id_; }
+    const std::string& get_key_share() const { return key_share_; }
+
+    // Derives the keys and starts probing the peer; is_client tells which
+    // key share belongs to the TCP client
+    void connect(const udp::endpoint& remote, uint32_t remote_conn_id, const std::string& remote_key_share,
+                 bool is_client);
+    void close();
+
+    // The peer answered our probe, so it receives what we send
+    bool is_established() const { return established_; }
+
+    // Queues a length-prefixed frame; sent runs once its last byte has been
+    // put on the wire (not yet acknowledged)
+    void send_frame(OutgoingFrame frame, EventHandler sent);
+    bool send_idle() const { return frames_.empty(); }
+
+    // Complete frames, in order, without the length prefix
+    void set_frame_handler(FrameHandler handler) { frame_handler_ = std::move(handler); }
+    // The peer stopped acknowledging data or broke the protocol
+    void set_failure_handler(EventHandler handler) { failure_handler_ = std::move(handler); }
+    // While paused, frames stay buffered and the advertised window shrinks
+    void pause() { paused_ = true; }
+    void resume();
+
+    DatagramChannelStats get_stats() const;
+
+private:
+    friend class DatagramTransport;
+
+    enum PacketType : uint8_t { DATA = 1, ACK = 2, PING = 3, PONG = 4 };
+
+    struct Segment {
+        PooledBuffer payload;
+        std::chrono::steady_clock::time_point sent_at;
+    };
+
+    using CipherContext = std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)>;
+
+    void handle_packet(const uint8_t* data, size_t length);
+    void send_packet(const uint8_t* prefix, size_t prefix_length, const uint8_t* payload = nullptr,
+                     size_t payload_length = 0);
+
+    // Sender
+    void flush();
+    void transmit(uint64_t seq, Segment& segment);
+    void handle_ack(const uint8_t* body, size_t length);
+    void detect_losses();
+    void update_cwnd(size_t bytes_acked, size_t flight_before, uint32_t delay_us);
+    void update_rtt(uint32_t rtt_us);
+
+    // Receiver
+    void handle_data(const uint8_t* body, size_t length);
+    void deliver();
+    void send_ack();
+    size_t free_window() const;
+
+    void arm_timer();
+    void on_tick();
+    void fail(const char* reason);
+
+    DatagramTransport& transport_;
+    uint32_t conn_id_;
+    std::string key_share_;
+    udp::endpoint remote_;
+    uint32_t remote_conn_id_ = 0;
+    CipherContext seal_ctx_;
+    CipherContext open_ctx_;
+    uint64_t packet_number_ = 0;
+    bool connected_ = false;
+    bool closed_ = false;
+    boost::asio::steady_timer timer_;
+    bool timer_armed_ = false;
+
+    // Probing
+    bool established_ = false;
+    int probes_sent_ = 0;
+    std::chrono::steady_clock::time_point last_probe_at_;
+
+    // Sender: frames not yet cut into segments, then unacknowledged segments
+    std::deque<std::pair<OutgoingFrame, EventHandler>> frames_;
+    size_t frame_offset_ = 0;
+    size_t unsent_bytes_ = 0;
+    uint64_t next_seq_ = 0;
+    std::map<uint64_t, Segment> unacked_;
+    std::set<uint64_t> lost_;       // Unacknowledged and waiting for retransmission
+    size_t bytes_in_flight_ = 0;    // Unacknowledged and not lost
+    size_t peer_window_ = DATAGRAM_RECV_WINDOW;
+    uint64_t highest_acked_seq_ = 0;
+    std::chrono::steady_clock::time_point highest_acked_sent_at_;
+    std::chrono::steady_clock::time_point last_progress_at_;
+    std::chrono::steady_clock::time_point last_loss_at_;
+
+    // Congestion control
+    size_t cwnd_ = LEDBAT_INIT_CWND;
+    size_t ssthresh_ = SIZE_MAX;
+    bool slow_start_ = true;
+    std::deque<uint32_t> base_delays_;   // Per-minute minima, newest last
+    std::chrono::steady_clock::time_point base_minute_start_;
+    std::deque<uint32_t> current_delays_;
+    double queuing_delay_us_ = 0;
+    double srtt_us_ = 0;
+    double rttvar_us_ = 0;
+    std::chrono::microseconds rto_{DATAGRAM_MIN_RTO * 5};
+    uint64_t retransmits_ = 0;
+    uint64_t timeouts_ = 0;
+
+    // Receiver
+    uint64_t recv_next_ = 0;
+    std::map<uint64_t, PooledBuffer> out_of_order_;
+    size_t out_of_order_bytes_ = 0;
+    std::vector<uint8_t> stream_;   // In-order bytes not yet delivered as frames
+    size_t stream_offset_ = 0;
+    bool paused_ = false;
+    uint32_t last_data_timestamp_ = 0;
+    uint32_t last_delay_ = 0;
+    int unacked_packets_ = 0;
+    bool ack_pending_ = false;
+    std::chrono::steady_clock::time_point ack_deadline_;
+    std::vector<uint8_t> plain_buffer_;
+
+    FrameHandler frame_handler_;
+    EventHandler failure_handler_;
+};
+
+} // namespace aura
@@ -1,7 +1,14 @@
 #pragma once
 
 #include "aura.pb.h"
+#include "buffer_pool.hpp"
+#include "trace.hpp"
 #include <boost/asio.hpp>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <map>
 #include <memory>
 #include <vector>
 #include <string>
@@ -10,6 +17,62 @@
 
 namespace aura {
 
+// DHT message version we speak (see aura.proto)
+const uint32_t DHT_PROTOCOL_VERSION = 2;
+// Largest datagram we build; fits the IPv6 minimum MTU (1280) with headers
+const size_t MAX_DATAGRAM_PAYLOAD = 1200;
+// Receive buffer, large enough for any UDP datagram
+const size_t DHT_RECV_BUFFER_SIZE = 65536;
+// Initial arena block for parsing datagrams; holds a full provider list
+const size_t DHT_ARENA_BLOCK_SIZE = 16 * 1024;
+
+// Kademlia parameters
+const size_t K_BUCKET_SIZE = 8;   // Replication factor / bucket size
+const size_t LOOKUP_ALPHA = 3;    // Parallel requests per lookup round
+const size_t LOOKUP_MAX_QUERIES = 24; // Upper bound on nodes queried by one lookup
+// A queried node that has not answered by then is skipped for the next candidate
+const std::chrono::milliseconds LOOKUP_QUERY_TIMEOUT{500};
+// How long a FindNodeResponse is accepted after our FindNodeRequest
+const std::chrono::seconds FIND_NODE_QUERY_TIMEOUT{5};
+
+// Path caching: a cached copy lives at most CACHE_TTL_MAX and the TTL halves
+// for every known node that sits closer to the key than the caching node.
+const std::chrono::seconds CACHE_TTL_MAX{3600};
+const std::chrono::seconds CACHE_TTL_MIN{60};
+
+// Hot key detection: a key served more than HOT_KEY_THRESHOLD times within
+// HOT_KEY_WINDOW gets pushed to HOT_KEY_REPLICAS nodes instead of K_BUCKET_SIZE.
+const std::chrono::seconds HOT_KEY_WINDOW{60};
+const uint32_t HOT_KEY_THRESHOLD = 16;
+const size_t HOT_KEY_REPLICAS = 3 * K_BUCKET_SIZE;
+
+// Overload protection. Each source address may send DHT_SOURCE_RATE requests
+// per second, in bursts of up to DHT_SOURCE_BURST; buckets are kept for the
+// DHT_MAX_SOURCES most recently seen sources. Admitted requests from all
+// sources are served at up to DHT_SERVE_RATE per second; the rest wait in a
+// queue of DHT_MAX_QUEUED_REQUESTS, which bounds their wait to about 130ms,
+// and are shed beyond it. Only responses that match one of our outstanding
+// queries skip both limits; any other response is charged to its source and
+// dropped.
+const double DHT_SOURCE_RATE = 20;
+const double DHT_SOURCE_BURST = 50;
+const size_t DHT_MAX_SOURCES = 4096;
+const double DHT_SERVE_RATE = 2000;
+const double DHT_SERVE_BURST = 200;
+const size_t DHT_MAX_QUEUED_REQUESTS = 256;
+// Datagrams read, and queued requests served, per handler run
+const size_t DHT_BATCH_SIZE = 64;
+
+struct DhtStats {
+    uint64_t responses = 0;
+    uint64_t requests_served = 0;
+    uint64_t requests_limited = 0;  // Over their source's rate
+    uint64_t requests_shed = 0;     // Queue full
+    uint64_t unsolicited = 0;       // Responses to nothing we asked, dropped
+    uint64_t sources_evicted = 0;   // Least recently seen sources forgotten to make room
+    double queue_delay_ms = 0;      // Smoothed wait of served requests
+};
+
 // Represents a single node in the routing table
 struct DhtPeer {
     std::string id;
@@ -34,6 +97,8 @@ public:
     void add_peer(const DhtPeer& peer);
     // Finds k closest nodes to the given target_id
     std::vector<DhtPeer> find_closest_peers(const std::string& target_id, size_t count);
+    // Counts known nodes that are strictly closer to target_id than peer_id
+    size_t count_closer_peers(const std::string& target_id, const std::string& peer_id) const;
     std::string get_self_id() const { return self_id_; }
 private:
     std::string self_id_;
@@ -42,6 +107,16 @@ private:
 
 class DhtNode {
 public:
+    using Clock = std::chrono::steady_clock;
+
+    // A provider record in local storage
+    struct StoredProvider {
+        PeerInfo info;
+        std::string compact; // Version 2 encoding, empty if the address does not parse
+        bool expires = false;
+        Clock::time_point expires_at;
+    };
+
     DhtNode(boost::asio::io_context& io_context, unsigned short port, const std::string& self_id);
     void start();
     void bootstrap(const std::string& host, unsigned short port);
@@ -55,24 +130,133 @@ public:
     // Looks for who has a file (key = file_hash)
     void find_value(const std::string& key, std::function<void(const std::vector<PeerInfo>&)> callback);
 
+    const DhtStats& get_stats() const { return stats_; }
+    size_t get_queued_requests() const { return request_queue_.size(); }
+
+    // Fills a FindNodeResponse in the encoding the requester understands
+    static void add_neighbors(FindNodeResponse* res, const std::vector<DhtPeer>& peers, uint32_t version);
+    static std::vector<DhtPeer> decode_neighbors(const FindNodeResponse& res);
+    static std::vector<PeerInfo> decode_providers(const PeerList& list);
+    // Splits providers into numbered FindValueResponse parts of at most MAX_DATAGRAM_PAYLOAD bytes
+    static std::vector<MessageWrapper> pack_providers(const std::string& key, const std::string& sender_id,
+                                                      const std::vector<StoredProvider>& providers,
+                                                      uint32_t version);
+
 private:
+    using FindValueCallback = std::function<void(const std::vector<PeerInfo>&)>;
+
+    // Request-rate tracking for a stored key
+    struct KeyActivity {
+        Clock::time_point window_start;
+        uint32_t requests = 0;
+        bool replicated = false; // Already widened during the current window
+    };
+
+    // Refills continuously at rate tokens per second, holding at most burst
+    struct TokenBucket {
+        double tokens = 0;
+        Clock::time_point updated;
+        bool try_take(double rate, double burst, Clock::time_point now);
+    };
+
+    struct SourceBucket {
+        TokenBucket bucket;
+        std::list<boost::asio::ip::address>::iterator lru; // Position in source_lru_
+    };
+
+    // An admitted request waiting for the serve budget
+    struct QueuedRequest {
+        PooledBuffer datagram;
+        boost::asio::ip::udp::endpoint sender;
+        Clock::time_point received_at;
+    };
+
+    struct QueriedPeer {
+        DhtPeer peer;
+        Clock::time_point deadline;
+    };
+
+    // State of an iterative find_value lookup
+    struct ValueLookup {
+        std::vector<FindValueCallback> callbacks;
+        std::vector<DhtPeer> candidates;      // Not yet queried, sorted by distance
+        std::vector<QueriedPeer> in_flight;   // Queried, waiting for an answer
+        std::vector<DhtPeer> without_value;   // Answered with closer peers only
+        std::vector<std::string> seen;        // Ids ever added to candidates
+        // Providers arrive in one or more parts from the first node that has them
+        std::vector<PeerInfo> found;
+        boost::asio::ip::udp::endpoint found_from;
+        uint32_t parts_expected = 0;
+        uint32_t parts_received = 0;
+        size_t queried = 0;
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        std::unique_ptr<boost::asio::steady_timer> query_timer; // Earliest in-flight deadline
+        trace::Span span;
+    };
+
     void do_receive();
+    // Drains the socket: expected responses are handled at once, requests are queued
+    void read_datagrams();
+    // A response from a node we queried, for a lookup or FindNode still waiting on it
+    bool is_expected_response(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& sender);
+    void admit_request(const boost::asio::ip::udp::endpoint& sender, size_t length, Clock::time_point now);
+    bool take_source_token(const boost::asio::ip::address& source, Clock::time_point now);
+    void serve_requests();
     void handle_message(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& sender);
     void send(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& target);
 
+    // Sends our providers for key, split over as many datagrams as needed
+    void send_providers(const std::string& key, uint32_t version, const boost::asio::ip::udp::endpoint& target);
+
+    void send_store(const std::string& key, const PeerInfo& provider, uint32_t ttl,
+                    const boost::asio::ip::udp::endpoint& target);
+    void store_local(const std::string& key, const PeerInfo& provider, uint32_t ttl);
+    // Returns non-expired providers for key, dropping expired ones
+    std::vector<PeerInfo> get_providers(const std::string& key);
+
+    void continue_lookup(const std::string& key);
+    // Gives up on queried nodes past their deadline and moves on
+    void expire_queries(const std::string& key);
+    void finish_lookup(const std::string& key, std::vector<PeerInfo> providers);
+    void cache_along_path(const std::string& key, const ValueLookup& lookup,
+                          const std::vector<PeerInfo>& providers);
+    void handle_find_value_response(const FindValueResponse& res,
+                                    const boost::asio::ip::udp::endpoint& sender);
+
+    // Counts a FindValueRequest for key and widens replication once it is hot
+    void record_key_request(const std::string& key);
+
     boost::asio::io_context& io_context_;
     boost::asio::ip::udp::socket socket_;
     RoutingTable routing_table_;
     std::vector<uint8_t> recv_buffer_;
+    boost::asio::ip::udp::endpoint recv_endpoint_;
+    // Datagrams are parsed into this arena and reset after each one
+    alignas(8) std::array<char, DHT_ARENA_BLOCK_SIZE> arena_block_;
+    google::protobuf::Arena arena_;
 
     // Local storage: key (file hash) -> list of provider peers
-    std::unordered_map<std::string, std::vector<PeerInfo>> storage_;
+    std::unordered_map<std::string, std::vector<StoredProvider>> storage_;
+
+    // Request rate per stored key, used to spot hot keys
+    std::unordered_map<std::string, KeyActivity> key_activity_;
     
-    // Pending find_value requests: key (file hash) -> callback
-    std::unordered_map<std::string, std::function<void(const std::vector<PeerInfo>&)>> pending_find_value_;
+    // Pending find_value lookups: key (file hash) -> lookup state
+    std::unordered_map<std::string, std::unique_ptr<ValueLookup>> pending_find_value_;
     
+    // Overload protection
+    std::map<boost::asio::ip::address, SourceBucket> source_buckets_;
+    std::list<boost::asio::ip::address> source_lru_; // Least recently seen first
+    TokenBucket serve_bucket_;
+    std::deque<QueuedRequest> request_queue_;
+    boost::asio::steady_timer serve_timer_;
+    bool serve_scheduled_ = false;
+    DhtStats stats_;
+
     // Pending find_node requests: target_id -> callback
     std::unordered_map<std::string, std::function<void(const std::vector<DhtPeer>&)>> pending_find_node_;
+    // FindNodeRequests we sent: node endpoint -> deadline for its answer
+    std::map<boost::asio::ip::udp::endpoint, Clock::time_point> find_node_queries_;
 };
 
 } // namespace aura
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "file_sharer.hpp"
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace aura {
+
+// Completion handlers (DiskReadHandler/DiskWriteHandler) always run on the
+// io_context that owns the backend. A read reports ok=false on I/O errors;
+// a short read at end of file is ok.
+
+struct DiskOptions {
+    enum class Kind { AUTO, IO_URING, THREAD_POOL };
+    Kind kind = Kind::AUTO;
+    size_t threads = 4;          // Thread pool backend
+    unsigned queue_depth = 64;   // io_uring submission queue entries
+    bool direct_io = false;      // io_uring: O_DIRECT with registered buffers
+};
+
+// Asynchronous chunk I/O, so disk latency never blocks the io_context thread
+class DiskBackend {
+public:
+    virtual ~DiskBackend() = default;
+
+    virtual void async_read(const std::string& path, uint64_t offset, size_t length, DiskReadHandler handler) = 0;
+    // Writes length bytes of data from data_offset on, so one chunk can feed
+    // several writes; data is kept alive until the handler runs. Creates the
+    // file if it does not exist yet.
+    virtual void async_write(const std::string& path, uint64_t offset, ChunkData data, size_t data_offset,
+                             size_t length, DiskWriteHandler handler) = 0;
+
+    virtual const char* name() const = 0;
+    // Where completion handlers run
+    virtual boost::asio::io_context& get_io_context() = 0;
+};
+
+// Picks io_uring when requested (or AUTO) and the kernel allows it,
+// otherwise falls back to the thread pool backend.
+std::unique_ptr<DiskBackend> make_disk_backend(boost::asio::io_context& io_context, const DiskOptions& options);
+
+} // namespace aura
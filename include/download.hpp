@@ -0,0 +1,200 @@
+#pragma once
+
+#include "file_sharer.hpp"
+#include "aura.pb.h"
+#include "trace.hpp"
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace aura {
+
+class Node;    // Forward declaration
+class Session; // Forward declaration
+
+// Outstanding chunk requests kept per peer until its throughput is known
+const size_t PIPELINE_DEPTH = 4;
+// Once measured, a peer gets enough requests to cover this much transfer time
+const double PIPELINE_TARGET_SECONDS = 0.5;
+const size_t MIN_PIPELINE_DEPTH = 2;
+const size_t MAX_PIPELINE_DEPTH = 32;
+// A peer slower than this fraction of the fastest one is dropped after the
+// grace period, as long as another unchoked peer remains
+const double SLOW_PEER_RATIO = 0.2;
+const std::chrono::seconds SLOW_PEER_GRACE{10};
+// A request unanswered for this long marks the peer as stalled
+const std::chrono::seconds REQUEST_TIMEOUT{30};
+// Endgame starts once every missing chunk has been requested and no more
+// than this many chunks are still outstanding
+const size_t ENDGAME_THRESHOLD = 4;
+// Maximum number of peers asked for the same chunk during endgame
+const size_t ENDGAME_MAX_REQUESTS = 3;
+// A peer is dropped after sending this many chunks that fail verification
+const uint32_t MAX_CORRUPT_CHUNKS = 2;
+
+// Streaming: chunks requested ahead of the consumer's position
+const size_t DEFAULT_STREAM_WINDOW = 16;
+
+// Receives the verified prefix of a streaming download, one chunk at a time
+// and in order. The consumer calls consumed() once it is done with the
+// chunk, which moves the read-ahead window forward. A null chunk marks the
+// end of the file.
+using StreamHandler = std::function<void(ChunkData chunk, std::function<void()> consumed)>;
+
+struct DownloadStats {
+    std::chrono::steady_clock::time_point started_at;
+    uint64_t bytes_received = 0;   // Verified payload bytes
+    uint64_t wire_bytes = 0;       // Chunk payload bytes as sent (after compression)
+    uint64_t duplicate_bytes = 0;  // Payload bytes of chunks we already had
+    uint32_t duplicate_chunks = 0;
+    uint32_t failed_chunks = 0;    // Chunks that did not match their hash or failed to decompress
+    uint32_t endgame_requests = 0; // Extra requests issued during endgame
+    uint32_t cancels_sent = 0;
+};
+
+// Downloads a single file from a set of provider sessions
+class Download : public std::enable_shared_from_this<Download> {
+public:
+    Download(Node& node, const std::string& file_hash, const std::string& output_path);
+
+    // Called once a client session has finished the Handshake exchange
+    void add_peer(std::shared_ptr<Session> session);
+    void remove_peer(std::shared_ptr<Session> session);
+
+    void handle_metadata(std::shared_ptr<Session> session, const Metadata& metadata);
+    // Takes over the chunk's data for verification
+    void handle_chunk(std::shared_ptr<Session> session, SendChunk& chunk);
+    void handle_choke(std::shared_ptr<Session> session, bool choked);
+    void handle_bitfield(std::shared_ptr<Session> session, const Bitfield& bitfield);
+    void handle_have(std::shared_ptr<Session> session, uint32_t chunk_index);
+
+    // Fetches chunks in order, at most window chunks past the consumer, and
+    // hands the contiguous verified prefix to handler. Call before metadata arrives.
+    void set_stream_handler(StreamHandler handler, size_t window = DEFAULT_STREAM_WINDOW);
+
+    // Providers held back to replace peers that turn out slow; preferred
+    // ones (on the LAN) are used before the others
+    void add_spare_providers(std::vector<PeerInfo> providers, bool preferred = false);
+    // Records a provider we connect to; false if it was already known
+    bool add_provider(const std::string& peer_id);
+    // A session opened for provider_id; it joins as a peer after the Handshake
+    void add_connection(const Session* session, const std::string& provider_id);
+    // With no peer or connection attempt left, connects the next spare
+    // provider, or fails the download once there is none
+    void replenish_providers();
+    size_t get_provider_count() const { return providers_.size(); }
+    // Set once the initial provider lookups are in
+    void set_started() { started_ = true; }
+    bool is_started() const { return started_; }
+    size_t get_stored_count() const { return stored_count_; }
+
+    // Periodic check for slow and stalled peers, driven by Node
+    void on_tick();
+
+    // Partial seeding: chunks that are verified and on disk can be served
+    bool has_metadata() const { return has_metadata_; }
+    bool awaits_metadata_from(const Session* session) const { return !has_metadata_ && metadata_peer_ == session; }
+    const FileInfo& get_file_info() const { return file_info_; }
+    bool has_stored_chunk(uint32_t chunk_index) const {
+        return chunk_index < stored_.size() && stored_[chunk_index];
+    }
+    void fill_bitfield(Bitfield* bitfield) const;
+
+    bool is_finished() const { return finished_; }
+    const std::string& get_file_hash() const { return file_hash_; }
+    const DownloadStats& get_stats() const { return stats_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct InFlight {
+        uint32_t chunk_index;
+        Clock::time_point requested_at;
+        trace::Span span; // Request until the chunk arrives
+    };
+
+    struct PeerState {
+        std::shared_ptr<Session> session;
+        std::vector<InFlight> in_flight;
+        Clock::time_point joined_at;
+        bool choked = true; // The peer refuses our requests until it unchokes us
+        bool interested = false; // What we last told the peer
+        uint32_t corrupt_chunks = 0;
+        // Chunks the peer announced; without a Bitfield it is assumed to hold everything
+        bool has_bitfield = false;
+        std::vector<uint8_t> bits{};
+    };
+
+    PeerState* find_peer(const std::shared_ptr<Session>& session);
+    static std::vector<InFlight>::iterator find_in_flight(PeerState& peer, uint32_t chunk_index);
+    static bool peer_has(const PeerState& peer, uint32_t chunk_index);
+    // Bound on chunk indexes a peer may announce
+    size_t chunk_limit() const;
+    // The peer holds a chunk we still need; true until the metadata is known
+    bool wants_from(const PeerState& peer) const;
+    // Sends Interested when wants_from changed since we last told the peer
+    void update_interest(PeerState& peer);
+    size_t pipeline_depth(const PeerState& peer) const;
+    // Local peers first, then fastest first
+    std::vector<PeerState*> ranked_peers();
+    void drop_peer(PeerState& peer, const char* reason);
+    void request_metadata();
+    void schedule(PeerState& peer);
+    void schedule_all();
+    bool in_endgame() const;
+    void send_request(PeerState& peer, uint32_t chunk_index);
+    // Forgets a request; outcome ends its span unless the chunk arrived
+    void release_request(PeerState& peer, uint32_t chunk_index, const char* outcome);
+    // Neither held nor waiting for verification
+    bool is_missing(uint32_t chunk_index) const { return !have_[chunk_index] && !verifying_[chunk_index]; }
+    void on_chunk_verified(std::shared_ptr<Session> session, uint32_t chunk_index, bool ok,
+                           std::vector<uint8_t> data);
+    void on_chunk_written(uint32_t chunk_index, bool ok);
+    bool streaming() const { return static_cast<bool>(stream_handler_); }
+    void deliver_stream();
+    void on_stream_consumed();
+    // Finishes once every chunk is on disk and, when streaming, consumed
+    void maybe_finish();
+    void finish();
+    // Gives up: stops the peers and lets Node forget the download, so the
+    // hash can be requested again
+    void fail(const char* reason);
+
+    Node& node_;
+    std::string file_hash_;
+    FileInfo file_info_;
+    bool has_metadata_ = false;
+    Session* metadata_peer_ = nullptr; // Peer we asked for metadata
+    bool finished_ = false;
+
+    std::vector<bool> have_;
+    std::vector<bool> verifying_;         // Received, hashing on the verifier pool
+    std::vector<bool> stored_;            // Verified and written, safe to serve
+    size_t stored_count_ = 0;
+    std::vector<uint32_t> request_count_; // Peers currently asked for each chunk
+    size_t chunks_remaining_ = 0;
+    size_t unrequested_ = 0;              // Missing chunks nobody was asked for
+    size_t pending_writes_ = 0;           // Verified chunks not yet on disk
+
+    StreamHandler stream_handler_;
+    size_t stream_window_ = DEFAULT_STREAM_WINDOW;
+    uint32_t stream_next_ = 0;     // Next chunk to hand to the consumer
+    uint32_t stream_consumed_ = 0; // Chunks the consumer is done with
+    std::map<uint32_t, ChunkData> stream_buffer_; // Verified, waiting for earlier chunks
+
+    trace::Span span_; // The whole transfer
+
+    std::vector<PeerState> peers_;
+    std::vector<PeerInfo> spare_providers_;
+    std::unordered_set<std::string> providers_; // Peer ids we connected to
+    std::unordered_map<const Session*, std::string> connections_; // Open sessions -> provider id
+    bool started_ = false;
+    DownloadStats stats_;
+};
+
+} // namespace aura
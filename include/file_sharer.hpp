@@ -1,26 +1,83 @@
 #pragma once
 
+#include "chunk_cache.hpp"
 #include <string>
 #include <vector>
+#include <memory>
+#include <functional>
 #include <cstdint>
+#include <unordered_map>
 
 namespace aura {
 
 // Constant for chunk size (256 KB)
 const uint32_t CHUNK_SIZE = 256 * 1024;
 
+// One file of a directory share, at offset within the share's byte stream
+struct FileEntry {
+    std::string path; // Relative to FileInfo::file_path
+    uint64_t size;
+    uint64_t offset;
+};
+
 struct FileInfo {
     std::string file_path;
     std::vector<uint8_t> file_hash;
     uint64_t file_size;
     std::vector<std::vector<uint8_t>> chunk_hashes;
+    // Empty for a single file. For a directory share file_path is the root
+    // and file_size the length of all files laid out back to back.
+    std::vector<FileEntry> files;
+};
+
+// The part of a chunk that lives in one file
+struct ChunkSegment {
+    std::string path;
+    uint64_t file_offset;
+    size_t chunk_offset;
+    size_t length;
 };
 
-class Node; // Forward declaration
+class Metadata; // Forward declaration
+
+// SHA-1 of a memory block
+std::vector<uint8_t> calculate_sha1(const char* data, size_t len);
+
+// Relative, '/'-separated and without "." or ".." components, so a manifest
+// cannot write outside the download directory
+bool is_safe_path(const std::string& path);
+// Files a chunk spans, in order; a single file gives one segment
+std::vector<ChunkSegment> chunk_segments(const FileInfo& file_info, uint32_t chunk_index);
+// Root hash of a directory share (see Metadata in aura.proto)
+std::vector<uint8_t> manifest_root_hash(const FileInfo& file_info);
+
+void fill_metadata(const FileInfo& file_info, Metadata* metadata);
+// Returns false for inconsistent metadata: wrong chunk count, unsafe or
+// unsorted paths, or a manifest that does not match its root hash
+bool read_metadata(const Metadata& metadata, FileInfo* file_info);
+// Creates the directories and empty files of a directory share under file_path
+bool prepare_directory(const FileInfo& file_info);
+
+class Node;        // Forward declaration
+class DiskBackend; // Forward declaration
+
+using DiskReadHandler = std::function<void(bool ok, std::vector<uint8_t> data)>;
+using DiskWriteHandler = std::function<void(bool ok)>;
+using ChunkReadHandler = std::function<void(bool ok, ChunkData data)>;
 
 class FileSharer {
 public:
-    // Creates metadata for a file and saves it to a .aura file
+    FileSharer();
+    ~FileSharer();
+
+    // Backend used by the async chunk calls; without one they run inline
+    void set_disk_backend(std::unique_ptr<DiskBackend> backend);
+    DiskBackend* get_disk_backend() { return disk_backend_.get(); }
+
+    ChunkCache& get_chunk_cache() { return chunk_cache_; }
+
+    // Creates metadata for a file, or for every file below a directory, and
+    // saves it to <path>.aura
     bool share_file(const std::string& file_path, Node& node);
 
     // Loads metadata from a .aura file
@@ -31,6 +88,21 @@ public:
 
     // Writes a chunk to a file
     void save_chunk(const FileInfo& file_info, uint32_t chunk_index, const std::vector<uint8_t>& data);
+
+    // Non-blocking variants of get_chunk/save_chunk, the handler runs on the io_context.
+    // Reads go through the chunk cache, and concurrent misses on one chunk share a disk read.
+    void async_get_chunk(const FileInfo& file_info, uint32_t chunk_index, ChunkReadHandler handler);
+    void async_save_chunk(const FileInfo& file_info, uint32_t chunk_index, ChunkData data,
+                          DiskWriteHandler handler);
+
+private:
+    bool hash_directory(const std::string& root, FileInfo& file_info);
+    void complete_read(const std::string& key, bool ok, std::vector<uint8_t> data);
+
+    std::unique_ptr<DiskBackend> disk_backend_;
+    ChunkCache chunk_cache_;
+    // Handlers waiting on a disk read, keyed like the chunk cache
+    std::unordered_map<std::string, std::vector<ChunkReadHandler>> pending_reads_;
 };
 
 }
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "aura.pb.h"
+#include "buffer_pool.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace aura {
+
+// Multicast group and port shared by every node on the LAN
+const char* const LSD_MULTICAST_GROUP = "239.192.77.1";
+const unsigned short LSD_PORT = 7771;
+// Full announce of everything we serve
+const std::chrono::seconds LSD_ANNOUNCE_INTERVAL{60};
+// Providers not heard from for this long are forgotten
+const std::chrono::seconds LSD_PROVIDER_TTL{180};
+// How long a new download waits for LAN answers before it picks providers
+const std::chrono::milliseconds LSD_QUERY_WAIT{250};
+// File hashes per announce datagram; 40 x 22 bytes stays well under the MTU
+const size_t LSD_HASHES_PER_ANNOUNCE = 40;
+
+// Announces and discovers providers on the local network over UDP multicast
+// (TTL 1), next to the global DHT. Providers found this way are preferred,
+// since transfers within a rack are cheaper than across sites.
+class LocalDiscovery {
+public:
+    // Called for every provider heard from, including refreshes
+    using ProviderHandler = std::function<void(const std::string& file_hash, const PeerInfo& provider)>;
+    // Decides whether we answer a LocalQuery, or record an announced provider
+    using FileFilter = std::function<bool(const std::string& file_hash)>;
+
+    // interface_address selects the interface for the group ("0.0.0.0": any)
+    LocalDiscovery(boost::asio::io_context& io_context, const std::string& self_id, unsigned short tcp_port,
+                   const std::string& interface_address);
+
+    // Joins the group; false (with a log line) if multicast is unavailable
+    bool start();
+
+    void set_provider_handler(ProviderHandler handler) { provider_handler_ = std::move(handler); }
+    void set_file_filter(FileFilter filter) { file_filter_ = std::move(filter); }
+    // Files we want providers for; announces of other files are ignored
+    void set_wanted_filter(FileFilter filter) { wanted_filter_ = std::move(filter); }
+
+    // Also forgets providers whose announces have expired
+    void announce(const std::vector<std::string>& file_hashes);
+    void query(const std::string& file_hash);
+
+    // Providers heard from recently, most recent first
+    std::vector<PeerInfo> get_providers(const std::string& file_hash);
+    bool is_local_provider(const std::string& file_hash, const std::string& peer_id) const;
+
+private:
+    struct LocalProvider {
+        PeerInfo info;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    void do_receive();
+    void handle_message(const LocalDiscoveryMessage& msg, const boost::asio::ip::udp::endpoint& sender);
+    void send(const LocalDiscoveryMessage& msg);
+    void expire_providers();
+
+    boost::asio::io_context& io_context_;
+    boost::asio::ip::udp::socket socket_;
+    boost::asio::ip::udp::endpoint group_endpoint_;
+    boost::asio::ip::address_v4 interface_address_;
+    std::string self_id_;
+    unsigned short tcp_port_;
+    std::vector<uint8_t> recv_buffer_;
+    boost::asio::ip::udp::endpoint recv_endpoint_;
+
+    std::unordered_map<std::string, std::vector<LocalProvider>> providers_;
+    ProviderHandler provider_handler_;
+    FileFilter file_filter_;
+    FileFilter wanted_filter_;
+};
+
+} // namespace aura
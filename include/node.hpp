@@ -1,10 +1,16 @@
 #pragma once
 
+#include "compression.hpp"
+#include "datagram_transport.hpp"
 #include "dht.hpp"
+#include "download.hpp"
 #include "file_sharer.hpp"
+#include "local_discovery.hpp"
 #include "session.hpp"
+#include "verifier.hpp"
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <chrono>
 #include <string>
 #include <memory>
 #include <unordered_set>
@@ -15,21 +21,71 @@ namespace aura {
 namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
 
+// Providers we connect to for a single download
+const size_t MAX_DOWNLOAD_PEERS = 4;
+
+// Admission control for inbound sessions; connections beyond either cap are
+// closed right after accept, before any TLS work. Our own outbound sessions
+// are not counted.
+const size_t DEFAULT_MAX_SESSIONS = 256;
+const size_t MAX_PENDING_HANDSHAKES = 32;
+
+// Upload slots: peers we serve at the same time, one of them rotated optimistically
+const size_t DEFAULT_UPLOAD_SLOTS = 4;
+const std::chrono::seconds RECHOKE_INTERVAL{10};
+const int OPTIMISTIC_UNCHOKE_ROUNDS = 3; // Rotate the optimistic slot every 3 rechokes
+
 class Node {
 public:
     Node(boost::asio::io_context& io_context, short tcp_port, short udp_port);
 
     void listen(short port);
-    void connect(const std::string& host, const std::string& port);
+    std::shared_ptr<Session> connect(const std::string& host, const std::string& port);
     
     // File management
+    // Shares a file, or a whole directory tree under one root hash
     void announce_file(const std::string& file_path);
-    void download_file(const std::string& file_hash_hex);
+    // A stream_handler turns on streaming mode (see Download::set_stream_handler)
+    void download_file(const std::string& file_hash_hex, StreamHandler stream_handler = nullptr,
+                       size_t stream_window = DEFAULT_STREAM_WINDOW);
+    void on_download_finished(const std::string& file_hash);
+    // Connects a download to a provider it has not used yet; LAN providers
+    // are marked local so the download prefers them
+    void connect_provider(std::shared_ptr<Download> download, const PeerInfo& provider);
+
+    // Multicast discovery on the LAN; false if the group cannot be joined
+    bool enable_local_discovery(const std::string& interface_address);
+    // Offers peers a UDP channel for chunk data; false if no port can be bound
+    bool enable_datagram_transport();
+
+    // --- Serving complete and partial files ---
+    // FileInfo of a file we seed or download (once its metadata is known)
+    const FileInfo* find_file(const std::string& file_hash) const;
+    // The chunk is verified and on disk
+    bool has_chunk(const std::string& file_hash, uint32_t chunk_index) const;
+    // Returns false if we neither seed nor download the file
+    bool fill_bitfield(const std::string& file_hash, Bitfield* bitfield) const;
+    // A download wrote a verified chunk; first_chunk announces us as a provider
+    void on_chunk_stored(const std::string& file_hash, uint32_t chunk_index, bool first_chunk);
+
+    // --- Upload slots and instrumentation ---
+    void set_upload_slots(size_t slots) { upload_slots_ = std::max<size_t>(slots, 1); }
+    void set_max_sessions(size_t sessions) { max_sessions_ = std::max<size_t>(sessions, 1); }
+    // Logs per-peer transfer stats every interval (0 disables)
+    void set_stats_interval(std::chrono::seconds interval) { stats_interval_ = interval; }
+    // Stops the io_context once the last download has finished
+    void set_exit_on_complete(bool exit) { exit_on_complete_ = exit; }
+    // Replaces the verification pool; call before any download starts
+    void set_verify_threads(size_t threads);
+    void log_stats();
 
     // --- Getters ---
     const std::string& get_peer_id() const { return peer_id_; }
     FileSharer& get_file_sharer() { return file_sharer_; }
+    ChunkCompressor& get_chunk_compressor() { return chunk_compressor_; }
+    ChunkVerifier& get_chunk_verifier() { return *chunk_verifier_; }
     DhtNode* get_dht_node() { return dht_node_.get(); }
+    DatagramTransport* get_datagram_transport() { return datagram_transport_.get(); }
     ssl::context& get_ssl_context() { return ssl_context_; }
 
     // Map <file hash, file info>
@@ -38,7 +94,22 @@ public:
 private:
     void do_accept();
     void generate_id();
+    void generate_certificate();
+    void announce_provider(const std::string& file_hash);
+    // Picks providers once the LAN and DHT lookups of a new download are in
+    void start_download(std::shared_ptr<Download> download, const std::vector<PeerInfo>& dht_providers);
+    void on_local_provider(const std::string& file_hash, const PeerInfo& provider);
+    // Files we seed, plus downloads with at least one chunk on disk
+    std::vector<std::string> get_served_files() const;
     void remove_session(std::shared_ptr<Session> session);
+    // Inbound sessions and pending handshakes are both under their caps
+    bool admit_inbound() const;
+
+    // Once a second: refresh peer rates, drive downloads, rechoke, log stats
+    void start_tick_timer();
+    void on_tick();
+    void rechoke();
+    void on_peer_interested(std::shared_ptr<Session> session);
 
     boost::asio::io_context& io_context_;
     ssl::context ssl_context_;
@@ -46,11 +117,31 @@ private:
     std::string peer_id_; // 160-bit node ID (SHA-1)
     short self_tcp_port_; // Our TCP port to announce in the DHT
     
+    // Declared before the sessions so it outlives their channels
+    std::unique_ptr<DatagramTransport> datagram_transport_;
+
     // Using a set to store active sessions.
     std::unordered_set<std::shared_ptr<Session>> sessions_;
 
+    // Active downloads: file hash -> download
+    std::unordered_map<std::string, std::shared_ptr<Download>> downloads_;
+
+    boost::asio::steady_timer tick_timer_;
+    std::chrono::steady_clock::time_point last_tick_;
+    size_t upload_slots_ = DEFAULT_UPLOAD_SLOTS;
+    size_t max_sessions_ = DEFAULT_MAX_SESSIONS;
+    uint64_t sessions_rejected_ = 0;
+    std::chrono::seconds stats_interval_{0};
+    uint64_t ticks_ = 0;
+    bool exit_on_complete_ = false;
+    int rechoke_round_ = 0;
+    std::weak_ptr<Session> optimistic_unchoke_;
+
     FileSharer file_sharer_;
+    ChunkCompressor chunk_compressor_;
+    std::unique_ptr<ChunkVerifier> chunk_verifier_;
     std::unique_ptr<DhtNode> dht_node_;
+    std::unique_ptr<LocalDiscovery> local_discovery_;
 
     friend class Session; // Give Session access to Node's private methods
 };
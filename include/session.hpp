@@ -2,14 +2,51 @@
 
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_set>
 #include "aura.pb.h"
+#include "buffer_pool.hpp"
+#include "datagram_transport.hpp"
+#include "file_sharer.hpp"
 
 namespace aura {
 
 namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
 
-class Node; // Forward declaration
+// Every message on a session is prefixed with its length (4 bytes, big-endian)
+const size_t FRAME_HEADER_SIZE = 4;
+// Largest frame we accept: a full chunk plus room for the envelope
+const uint32_t MAX_FRAME_SIZE = CHUNK_SIZE + 64 * 1024;
+// Metadata of a large file or directory share; accepted only from the peer
+// a download asked for it
+const uint32_t MAX_METADATA_FRAME_SIZE = 64 * 1024 * 1024;
+
+// Initial arena block for parsing incoming frames. A parsed SendChunk
+// envelope fits, so steady-state parsing allocates no arena blocks; its data
+// is still one heap allocation, which the download takes over for verification.
+const size_t SESSION_ARENA_BLOCK_SIZE = 4 * 1024;
+
+// A peer has this long to complete TLS and our Handshake exchange
+const std::chrono::seconds HANDSHAKE_TIMEOUT{10};
+
+class Node;     // Forward declaration
+class Download; // Forward declaration
+
+// Transfer counters for one peer connection. Rates are refreshed by Node once a second.
+struct PeerStats {
+    uint64_t bytes_uploaded = 0;    // Chunk payload sent to the peer
+    uint64_t bytes_downloaded = 0;  // Chunk payload received from the peer
+    double upload_rate = 0;         // Bytes per second, smoothed
+    double download_rate = 0;       // Bytes per second, smoothed
+    double rtt_ms = 0;              // Smoothed time from RequestChunk to SendChunk
+    uint64_t window_uploaded = 0;   // Bytes since the last rate update
+    uint64_t window_downloaded = 0;
+};
 
 class Session : public std::enable_shared_from_this<Session> {
 public:
@@ -24,17 +61,80 @@ public:
 
     void do_write(const MessageWrapper& msg);
 
+    // Attaches the download this client session fetches chunks for
+    void set_download(std::shared_ptr<Download> download) { download_ = std::move(download); }
+
+    // Sends what we hold of a file and subscribes the peer to Have updates for it
+    void send_bitfield(const std::string& file_hash);
+    // Only sent to peers that got our Bitfield for the file
+    void send_have(const std::string& file_hash, uint32_t chunk_index);
+
     // Getter for the socket so Node can use it in async_connect
     ssl::stream<tcp::socket>& get_socket() { return socket_; }
+    const std::string& get_remote_peer_id() const { return remote_peer_id_; }
+    bool is_inbound() const { return session_type_ == Type::SERVER; }
+    // Both TLS and the Handshake message exchange are done
+    bool is_ready() const { return handshake_done_; }
+
+    // The peer was found through local (LAN) discovery
+    void set_local(bool local) { local_ = local; }
+    bool is_local() const { return local_; }
+
+    // Negotiated UDP channel for chunk data, or null
+    const DatagramChannel* get_datagram_channel() const { return datagram_.get(); }
+
+    const PeerStats& get_stats() const { return stats_; }
+    void update_rates(double elapsed_seconds);
+    void record_rtt(std::chrono::steady_clock::duration rtt);
+
+    // Upload slot control: a choked peer gets its requests discarded
+    void set_choked(bool choked);
+    bool is_choked() const { return am_choking_; }
+    // The peer told us it wants chunks we hold
+    bool is_interested() const { return peer_interested_; }
 
 private:
     void do_handshake();
-    void do_read();
+    void send_handshake();
+    void do_read_header();
+    void do_read_body(uint32_t length);
+    // Parses and handles one frame body; true if it carried a chunk
+    bool process_frame(const uint8_t* data, size_t length);
+    // Connects the channel we offered or accepted, or drops it if the peer did not
+    void start_datagram(const Handshake& handshake);
+    void on_datagram_frame(const uint8_t* data, size_t length);
+    void enqueue_frame(OutgoingFrame frame);
+    void do_write_next();
+    void handle_message(MessageWrapper& msg);
+
+    // Uploads are served one at a time, after our write queue has drained,
+    // so queued requests can still be cancelled by the peer.
+    void serve_next_upload();
+    // compressed is nullptr when the chunk goes out raw
+    void send_chunk(const RequestChunk& req, ChunkData data, std::shared_ptr<const std::string> compressed);
 
     ssl::stream<tcp::socket> socket_;
+    std::array<uint8_t, FRAME_HEADER_SIZE> header_buffer_;
     std::vector<uint8_t> read_buffer_;
+    // Incoming messages are parsed into this arena and reset after each one
+    alignas(8) std::array<char, SESSION_ARENA_BLOCK_SIZE> arena_block_;
+    google::protobuf::Arena arena_;
+    std::deque<OutgoingFrame> write_queue_;
+    std::deque<RequestChunk> upload_queue_;
+    std::shared_ptr<DatagramChannel> datagram_;
+    boost::asio::steady_timer handshake_timer_;
+    bool handshake_done_ = false;
     Node& node_;
     Type session_type_;
+    std::shared_ptr<Download> download_;
+    std::string remote_peer_id_;
+    bool peer_accepts_deflate_ = false; // Negotiated in the Handshake
+    std::unordered_set<std::string> bitfield_sent_; // Files the peer gets Have updates for
+    bool local_ = false;
+    bool reading_chunk_ = false; // An upload is waiting on the disk backend or compressor
+    bool am_choking_ = true; // Peers start choked and wait for a slot
+    bool peer_interested_ = false;
+    PeerStats stats_;
     bool stopped_ = false;
 };
 
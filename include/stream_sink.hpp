@@ -0,0 +1,39 @@
+#pragma once
+
+#include "download.hpp"
+#include <boost/asio.hpp>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace aura {
+
+// Writes a streaming download to a file descriptor (stdout, a pipe/FIFO or
+// a file) without blocking the io_context. A chunk counts as consumed once
+// it has been written, so a slow reader holds back the read-ahead window.
+class StreamSink : public std::enable_shared_from_this<StreamSink> {
+public:
+    // target "-" is stdout; everything the node logs goes to stderr from then on.
+    // Anything else is opened for writing (a FIFO blocks until a reader attaches).
+    // Returns nullptr if the target cannot be opened.
+    static std::shared_ptr<StreamSink> open(boost::asio::io_context& io_context, const std::string& target);
+
+    StreamSink(boost::asio::io_context& io_context, int fd);
+
+    // Handler for Download::set_stream_handler; keeps the sink alive
+    StreamHandler handler();
+
+private:
+    void on_chunk(ChunkData chunk, std::function<void()> consumed);
+    void write_next();
+
+    boost::asio::posix::stream_descriptor out_;
+    std::deque<std::pair<ChunkData, std::function<void()>>> queue_;
+    bool writing_ = false;
+    bool ended_ = false;  // The download delivered its last chunk
+    bool broken_ = false; // The reader went away; chunks are dropped
+};
+
+} // namespace aura
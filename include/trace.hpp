@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace aura {
+namespace trace {
+
+// Events kept in memory before new ones are dropped (about 100 bytes each)
+const size_t MAX_TRACE_EVENTS = 1000000;
+
+extern std::atomic<bool> g_enabled;
+
+// The only cost of a span while tracing is off is this load
+inline bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+// Starts recording; the events are written to path as Chrome trace-event
+// JSON (chrome://tracing, Perfetto) when recording stops.
+void start(const std::string& path);
+// Stops recording and writes the file. Does nothing when not recording.
+void stop();
+// SIGUSR2 handler body: starts or stops recording
+void toggle(const std::string& path);
+
+// A timed operation that may end in a later callback. Copyable, so it can
+// ride along in handlers; name and category must be string literals.
+class Span {
+public:
+    Span() = default;
+
+    // Returns an inactive span while tracing is off
+    static Span begin(const char* category, const char* name, int64_t arg = -1) {
+        return enabled() ? Span(category, name, arg) : Span();
+    }
+
+    // Records the span; ending an inactive or already ended span does nothing
+    void end();
+    // Same, for a span that did not complete; outcome (a string literal such
+    // as "cancelled") is shown as args.outcome
+    void end(const char* outcome);
+
+private:
+    Span(const char* category, const char* name, int64_t arg);
+
+    const char* category_ = nullptr;
+    const char* name_ = nullptr;
+    int64_t arg_ = -1;   // Shown as args.index when not negative
+    uint64_t start_us_ = 0;
+};
+
+} // namespace trace
+} // namespace aura
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "aura.pb.h"
+#include <boost/asio.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace aura {
+
+// Verification workers; hashing a 256 KB chunk is the only CPU-heavy step
+// of a download besides TLS
+const size_t DEFAULT_VERIFY_THREADS = 2;
+// Chunks queued or being hashed before sessions stop reading from their peers
+const size_t VERIFY_MAX_PENDING = 16;
+
+// A received chunk as it came off the wire
+struct VerifyJob {
+    std::string payload;
+    Compression compression = COMPRESSION_NONE;
+    uint32_t raw_size = 0;
+    std::vector<uint8_t> expected_hash;
+};
+
+// ok=false when the chunk failed to decompress or its SHA-1 does not match;
+// data holds the uncompressed chunk otherwise
+using VerifyHandler = std::function<void(bool ok, std::vector<uint8_t> data)>;
+
+struct VerifyStats {
+    uint64_t verified = 0;
+    uint64_t failed = 0;
+    uint64_t stalls = 0; // Times a session paused reading because the queue was full
+};
+
+// Decompresses and hashes received chunks on a worker pool, off the
+// io_context thread. Handlers and all bookkeeping run on the io_context.
+class ChunkVerifier {
+public:
+    ChunkVerifier(boost::asio::io_context& io_context, size_t threads = DEFAULT_VERIFY_THREADS,
+                  size_t max_pending = VERIFY_MAX_PENDING);
+    ~ChunkVerifier();
+
+    void submit(VerifyJob job, VerifyHandler handler);
+
+    // Readers check this before taking the next frame off the socket, and
+    // otherwise park a resume callback that runs once a job completes.
+    bool has_capacity() const { return pending_ < max_pending_; }
+    void wait_for_capacity(std::function<void()> resume);
+
+    size_t get_pending() const { return pending_; }
+    const VerifyStats& get_stats() const { return stats_; }
+
+private:
+    void on_complete();
+
+    boost::asio::io_context& io_context_;
+    boost::asio::thread_pool pool_;
+    size_t max_pending_;
+    size_t pending_ = 0;
+    std::deque<std::function<void()>> waiting_;
+    VerifyStats stats_;
+};
+
+} // namespace aura
@@ -0,0 +1,78 @@
+#include "buffer_pool.hpp"
+
+namespace aura {
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        storage_ = other.storage_;
+        size_class_ = other.size_class_;
+        size_ = other.size_;
+        other.pool_ = nullptr;
+        other.storage_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+void PooledBuffer::release() {
+    if (storage_) {
+        pool_->release(storage_, size_class_);
+        storage_ = nullptr;
+        pool_ = nullptr;
+    }
+}
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.buffers_acquired;
+
+    for (size_t i = 0; i < BUFFER_SIZE_CLASSES.size(); ++i) {
+        if (size > BUFFER_SIZE_CLASSES[i]) {
+            continue;
+        }
+        auto& free_list = free_lists_[i];
+        std::vector<uint8_t>* storage;
+        if (!free_list.empty()) {
+            storage = free_list.back().release();
+            free_list.pop_back();
+            ++stats_.buffers_reused;
+        } else {
+            storage = new std::vector<uint8_t>(BUFFER_SIZE_CLASSES[i]);
+            ++stats_.buffers_allocated;
+        }
+        return PooledBuffer(this, storage, static_cast<int>(i), size);
+    }
+
+    ++stats_.buffers_oversize;
+    return PooledBuffer(this, new std::vector<uint8_t>(size), -1, size);
+}
+
+void BufferPool::release(std::vector<uint8_t>* storage, int size_class) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (size_class < 0 || free_lists_[size_class].size() >= BUFFER_POOL_MAX_IDLE) {
+        ++stats_.buffers_freed;
+        delete storage;
+        return;
+    }
+    free_lists_[size_class].emplace_back(storage);
+}
+
+AllocationStats BufferPool::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void BufferPool::record_arena_parse(size_t arena_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.messages_parsed;
+    stats_.arena_bytes += arena_bytes;
+}
+
+} // namespace aura
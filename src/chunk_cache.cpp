@@ -0,0 +1,136 @@
+#include "chunk_cache.hpp"
+#include "file_sharer.hpp"
+#include <algorithm>
+#include <functional>
+
+namespace aura {
+
+namespace {
+
+const uint64_t ROW_SEEDS[4] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL,
+                               0xcbf29ce484222325ULL};
+
+size_t expected_entries(size_t budget_bytes) {
+    return std::max<size_t>(16, budget_bytes / CHUNK_SIZE);
+}
+
+} // namespace
+
+// --- FrequencySketch ---
+FrequencySketch::FrequencySketch(size_t expected_entries) {
+    // Power-of-two width, a few counters per entry keeps collisions rare
+    width_ = 16;
+    while (width_ < expected_entries * 4) {
+        width_ <<= 1;
+    }
+    table_.assign(4 * width_, 0);
+    sample_limit_ = expected_entries * SKETCH_SAMPLES_PER_ENTRY;
+}
+
+size_t FrequencySketch::index(size_t hash, int row) const {
+    uint64_t h = (static_cast<uint64_t>(hash) + ROW_SEEDS[row]) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+    return row * width_ + (h & (width_ - 1));
+}
+
+void FrequencySketch::increment(size_t hash) {
+    for (int row = 0; row < 4; ++row) {
+        uint8_t& counter = table_[index(hash, row)];
+        if (counter < SKETCH_MAX_COUNT) {
+            ++counter;
+        }
+    }
+    if (++samples_ >= sample_limit_) {
+        age();
+    }
+}
+
+uint8_t FrequencySketch::estimate(size_t hash) const {
+    uint8_t count = SKETCH_MAX_COUNT;
+    for (int row = 0; row < 4; ++row) {
+        count = std::min(count, table_[index(hash, row)]);
+    }
+    return count;
+}
+
+void FrequencySketch::age() {
+    for (auto& counter : table_) {
+        counter >>= 1;
+    }
+    samples_ /= 2;
+}
+
+// --- ChunkCache ---
+ChunkCache::ChunkCache(size_t budget_bytes)
+    : budget_(budget_bytes), sketch_(expected_entries(budget_bytes)) {}
+
+void ChunkCache::set_budget(size_t budget_bytes) {
+    budget_ = budget_bytes;
+    sketch_ = FrequencySketch(expected_entries(budget_bytes));
+    while (stats_.bytes > budget_) {
+        evict_lru();
+    }
+}
+
+std::string ChunkCache::make_key(const std::vector<uint8_t>& file_hash, uint32_t chunk_index) {
+    std::string key(file_hash.begin(), file_hash.end());
+    key.push_back(static_cast<char>((chunk_index >> 24) & 0xff));
+    key.push_back(static_cast<char>((chunk_index >> 16) & 0xff));
+    key.push_back(static_cast<char>((chunk_index >> 8) & 0xff));
+    key.push_back(static_cast<char>(chunk_index & 0xff));
+    return key;
+}
+
+ChunkData ChunkCache::get(const std::string& key) {
+    if (budget_ == 0) {
+        return nullptr;
+    }
+    sketch_.increment(std::hash<std::string>{}(key));
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        ++stats_.misses;
+        return nullptr;
+    }
+    ++stats_.hits;
+    lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+    return it->second.data;
+}
+
+void ChunkCache::put(const std::string& key, ChunkData data) {
+    if (!data || data->size() > budget_ || entries_.count(key)) {
+        return;
+    }
+
+    // Admission: the candidate must beat every victim it would displace,
+    // decided before any of them is evicted
+    uint8_t candidate = sketch_.estimate(std::hash<std::string>{}(key));
+    size_t victims = 0;
+    size_t freed = 0;
+    for (auto it = lru_.rbegin(); stats_.bytes - freed + data->size() > budget_; ++it, ++victims) {
+        if (candidate <= sketch_.estimate(std::hash<std::string>{}(*it))) {
+            ++stats_.rejected;
+            return;
+        }
+        freed += entries_.at(*it).data->size();
+    }
+    while (victims-- > 0) {
+        evict_lru();
+    }
+
+    stats_.bytes += data->size();
+    lru_.push_front(key);
+    entries_[key] = {std::move(data), lru_.begin()};
+    stats_.entries = entries_.size();
+    ++stats_.admitted;
+}
+
+void ChunkCache::evict_lru() {
+    auto it = entries_.find(lru_.back());
+    stats_.bytes -= it->second.data->size();
+    entries_.erase(it);
+    lru_.pop_back();
+    stats_.entries = entries_.size();
+    ++stats_.evictions;
+}
+
+} // namespace aura
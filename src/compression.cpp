@@ -0,0 +1,105 @@
+#include "compression.hpp"
+#include <algorithm>
+#include <zlib.h>
+
+namespace aura {
+
+bool deflate_compress(const uint8_t* data, size_t len, int level, std::string& out) {
+    uLongf out_len = compressBound(len);
+    out.resize(out_len);
+    if (compress2(reinterpret_cast<Bytef*>(&out[0]), &out_len, data, len, level) != Z_OK) {
+        return false;
+    }
+    out.resize(out_len);
+    return true;
+}
+
+bool deflate_decompress(const std::string& in, size_t raw_size, std::string& out) {
+    out.resize(raw_size);
+    uLongf out_len = raw_size;
+    int rc = uncompress(reinterpret_cast<Bytef*>(&out[0]), &out_len,
+                        reinterpret_cast<const Bytef*>(in.data()), in.size());
+    return rc == Z_OK && out_len == raw_size;
+}
+
+ChunkCompressor::ChunkCompressor(boost::asio::io_context& io_context, size_t threads)
+    : io_context_(io_context),
+      pool_(std::max<size_t>(threads, 1)) {}
+
+ChunkCompressor::~ChunkCompressor() {
+    pool_.join();
+}
+
+void ChunkCompressor::set_level(int level) {
+    level_ = std::max(0, std::min(level, 9));
+    cache_.clear();
+    lru_.clear();
+}
+
+void ChunkCompressor::async_compress(const std::string& file_hash, uint32_t chunk_index, ChunkData data,
+                                     CompressHandler handler) {
+    if (level_ == 0 || data->size() < COMPRESSION_MIN_SIZE) {
+        boost::asio::post(io_context_, [handler = std::move(handler)]() { handler(nullptr); });
+        return;
+    }
+
+    Key key = file_hash + std::to_string(chunk_index);
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+        ++cache_hits_;
+        lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+        boost::asio::post(io_context_, [handler = std::move(handler), result = it->second.data]() {
+            handler(result);
+        });
+        return;
+    }
+
+    auto& waiting = pending_[key];
+    waiting.push_back(std::move(handler));
+    if (waiting.size() > 1) {
+        return; // Already being compressed
+    }
+    boost::asio::post(pool_, [this, key, data = std::move(data), level = level_]() {
+        auto result = compress(*data, level);
+        boost::asio::post(io_context_, [this, key, result = std::move(result)]() mutable {
+            complete(key, std::move(result));
+        });
+    });
+}
+
+std::shared_ptr<const std::string> ChunkCompressor::compress(const std::vector<uint8_t>& data, int level) {
+    // Probe a sample at the fastest level; already-compressed data (archives,
+    // media) is detected here without paying for a full pass.
+    std::string sample;
+    size_t sample_len = std::min(data.size(), COMPRESSION_SAMPLE_SIZE);
+    if (!deflate_compress(data.data(), sample_len, 1, sample) ||
+        sample.size() >= sample_len * COMPRESSION_MAX_RATIO) {
+        return nullptr;
+    }
+    auto compressed = std::make_shared<std::string>();
+    if (!deflate_compress(data.data(), data.size(), level, *compressed) ||
+        compressed->size() >= data.size() * COMPRESSION_MAX_RATIO) {
+        return nullptr;
+    }
+    return compressed;
+}
+
+void ChunkCompressor::complete(const Key& key, std::shared_ptr<const std::string> result) {
+    auto handlers = std::move(pending_[key]);
+    pending_.erase(key);
+    if (!result) {
+        ++skipped_;
+    }
+
+    if (cache_.size() >= COMPRESSION_CACHE_ENTRIES) {
+        cache_.erase(lru_.back());
+        lru_.pop_back();
+    }
+    lru_.push_front(key);
+    cache_[key] = {result, lru_.begin()};
+    for (auto& handler : handlers) {
+        handler(result);
+    }
+}
+
+} // namespace aura
@@ -0,0 +1,696 @@
+#include "datagram_transport.hpp"
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace aura {
+
+namespace {
+
+// Packet layout: receiver's connection id (4) and packet number (8) in the
+// clear, authenticated as associated data; then the sealed body and tag
+const size_t PACKET_HEADER_SIZE = 12;
+const size_t PACKET_TAG_SIZE = 16;
+const size_t PACKET_NONCE_SIZE = 12;
+const size_t RECV_BUFFER_SIZE = 2048;
+// DATA body: type, sequence number, send timestamp, payload
+const size_t DATA_PREFIX_SIZE = 1 + 8 + 4;
+// ACK body: type, cumulative ack, window, delay, echoed timestamp, block count
+const size_t ACK_PREFIX_SIZE = 1 + 8 + 4 + 4 + 4 + 1;
+const size_t SOCKET_BUFFER_SIZE = 4 * 1024 * 1024;
+
+void put32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (24 - 8 * i));
+    }
+}
+
+void put64(uint8_t* out, uint64_t value) {
+    put32(out, static_cast<uint32_t>(value >> 32));
+    put32(out + 4, static_cast<uint32_t>(value));
+}
+
+uint32_t get32(const uint8_t* in) {
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
+
+uint64_t get64(const uint8_t* in) {
+    return (uint64_t(get32(in)) << 32) | get32(in + 4);
+}
+
+void make_nonce(uint8_t* nonce, uint64_t packet_number) {
+    std::memset(nonce, 0, PACKET_NONCE_SIZE);
+    put64(nonce + 4, packet_number);
+}
+
+// One key per direction, so the two sides never share a nonce space
+std::vector<uint8_t> derive_key(const char* label, const std::string& client_share, const std::string& server_share) {
+    std::string input = std::string(label) + client_share + server_share;
+    std::vector<uint8_t> key(EVP_MAX_MD_SIZE);
+    unsigned int key_len = 0;
+    EVP_Digest(input.data(), input.size(), key.data(), &key_len, EVP_sha256(), nullptr);
+    key.resize(key_len);
+    return key;
+}
+
+} // namespace
+
+// --- Transport ---
+
+DatagramTransport::DatagramTransport(boost::asio::io_context& io_context)
+    : io_context_(io_context),
+      socket_(io_context),
+      recv_buffer_(RECV_BUFFER_SIZE),
+      epoch_(std::chrono::steady_clock::now()),
+      rng_(std::random_device{}()) {}
+
+bool DatagramTransport::start() {
+    boost::system::error_code ec;
+    socket_.open(udp::v4(), ec);
+    if (!ec) socket_.bind(udp::endpoint(udp::v4(), 0), ec);
+    if (ec) {
+        std::cerr << "[Datagram] Transport disabled: " << ec.message() << std::endl;
+        socket_.close(ec);
+        return false;
+    }
+    // Best effort: bulk transfers overflow the default buffers
+    socket_.set_option(boost::asio::socket_base::receive_buffer_size(SOCKET_BUFFER_SIZE), ec);
+    socket_.set_option(boost::asio::socket_base::send_buffer_size(SOCKET_BUFFER_SIZE), ec);
+    port_ = socket_.local_endpoint().port();
+    std::cout << "[Datagram] Listening on UDP port " << port_ << std::endl;
+    do_receive();
+    return true;
+}
+
+std::shared_ptr<DatagramChannel> DatagramTransport::create_channel() {
+    uint32_t conn_id;
+    do {
+        conn_id = static_cast<uint32_t>(rng_());
+    } while (conn_id == 0 || channels_.count(conn_id));
+
+    std::string key_share(DATAGRAM_KEY_SHARE_SIZE, '\0');
+    RAND_bytes(reinterpret_cast<unsigned char*>(&key_share[0]), static_cast<int>(key_share.size()));
+    auto channel = std::make_shared<DatagramChannel>(*this, conn_id, std::move(key_share));
+    channels_[conn_id] = channel;
+    return channel;
+}
+
+void DatagramTransport::set_impairment(double loss, std::chrono::milliseconds delay) {
+    impair_loss_ = loss;
+    impair_delay_ = delay;
+    std::cout << "[Datagram] Simulating " << loss * 100 << "% loss and " << delay.count()
+              << "ms delay on outgoing packets" << std::endl;
+}
+
+void DatagramTransport::do_receive() {
+    socket_.async_receive_from(boost::asio::buffer(recv_buffer_), recv_endpoint_,
+        [this](boost::system::error_code ec, std::size_t length) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec) {
+                ++stats_.packets_received;
+                std::shared_ptr<DatagramChannel> channel;
+                if (length >= PACKET_HEADER_SIZE + 1 + PACKET_TAG_SIZE) {
+                    auto it = channels_.find(get32(recv_buffer_.data()));
+                    if (it != channels_.end() && !(channel = it->second.lock())) {
+                        channels_.erase(it); // Dropped without close()
+                    }
+                }
+                if (channel) {
+                    channel->handle_packet(recv_buffer_.data(), length);
+                } else {
+                    ++stats_.packets_rejected;
+                }
+            }
+            do_receive();
+        });
+}
+
+void DatagramTransport::send(PooledBuffer packet, const udp::endpoint& target) {
+    ++stats_.packets_sent;
+    if (impair_loss_ > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < impair_loss_) {
+        ++stats_.packets_impaired;
+        return;
+    }
+    if (impair_delay_.count() > 0) {
+        auto timer = std::make_shared<boost::asio::steady_timer>(io_context_, impair_delay_);
+        auto delayed = std::make_shared<PooledBuffer>(std::move(packet));
+        timer->async_wait([this, timer, delayed, target](const boost::system::error_code& ec) {
+            if (!ec) {
+                socket_.async_send_to(boost::asio::buffer(delayed->data(), delayed->size()), target,
+                    [delayed](boost::system::error_code /*ec*/, std::size_t /*bytes_sent*/) {});
+            }
+        });
+        return;
+    }
+    auto buffer = boost::asio::buffer(packet.data(), packet.size());
+    socket_.async_send_to(buffer, target,
+        [packet = std::move(packet)](boost::system::error_code /*ec*/, std::size_t /*bytes_sent*/) {});
+}
+
+void DatagramTransport::release(uint32_t conn_id) {
+    channels_.erase(conn_id);
+}
+
+uint32_t DatagramTransport::timestamp() const {
+    auto elapsed = std::chrono::steady_clock::now() - epoch_;
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+}
+
+// --- Channel ---
+
+DatagramChannel::DatagramChannel(DatagramTransport& transport, uint32_t conn_id, std::string key_share)
+    : transport_(transport),
+      conn_id_(conn_id),
+      key_share_(std::move(key_share)),
+      seal_ctx_(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free),
+      open_ctx_(EVP_CIPHER_CTX_new(), &EVP_CIPHER_CTX_free),
+      timer_(transport.io_context_),
+      plain_buffer_(RECV_BUFFER_SIZE) {}
+
+DatagramChannel::~DatagramChannel() {
+    // The transport prunes our entry lazily; it may already be gone
+    closed_ = true;
+}
+
+void DatagramChannel::connect(const udp::endpoint& remote, uint32_t remote_conn_id,
+                              const std::string& remote_key_share, bool is_client) {
+    const std::string& client_share = is_client ? key_share_ : remote_key_share;
+    const std::string& server_share = is_client ? remote_key_share : key_share_;
+    auto client_key = derive_key("aura datagram client", client_share, server_share);
+    auto server_key = derive_key("aura datagram server", client_share, server_share);
+    EVP_EncryptInit_ex(seal_ctx_.get(), EVP_aes_256_gcm(), nullptr,
+                       (is_client ? client_key : server_key).data(), nullptr);
+    EVP_DecryptInit_ex(open_ctx_.get(), EVP_aes_256_gcm(), nullptr,
+                       (is_client ? server_key : client_key).data(), nullptr);
+
+    remote_ = remote;
+    remote_conn_id_ = remote_conn_id;
+    connected_ = true;
+    base_minute_start_ = std::chrono::steady_clock::now();
+    arm_timer(); // Starts probing
+}
+
+void DatagramChannel::close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    timer_.cancel();
+    frames_.clear();
+    transport_.release(conn_id_);
+}
+
+void DatagramChannel::send_frame(OutgoingFrame frame, EventHandler sent) {
+    if (closed_) {
+        return;
+    }
+    unsent_bytes_ += frame.size();
+    frames_.emplace_back(std::move(frame), std::move(sent));
+    flush();
+}
+
+void DatagramChannel::resume() {
+    if (!paused_ || closed_) {
+        return;
+    }
+    paused_ = false;
+    deliver();
+    if (!closed_) {
+        send_ack(); // Window update
+    }
+}
+
+DatagramChannelStats DatagramChannel::get_stats() const {
+    DatagramChannelStats stats;
+    stats.cwnd = cwnd_;
+    stats.bytes_in_flight = bytes_in_flight_;
+    stats.srtt_ms = srtt_us_ / 1000;
+    stats.queuing_delay_ms = queuing_delay_us_ / 1000;
+    stats.retransmits = retransmits_;
+    stats.timeouts = timeouts_;
+    return stats;
+}
+
+void DatagramChannel::send_packet(const uint8_t* prefix, size_t prefix_length, const uint8_t* payload,
+                                  size_t payload_length) {
+    size_t body_length = prefix_length + payload_length;
+    PooledBuffer packet = BufferPool::instance().acquire(PACKET_HEADER_SIZE + body_length + PACKET_TAG_SIZE);
+    uint8_t* out = packet.data();
+    put32(out, remote_conn_id_);
+    put64(out + 4, packet_number_);
+
+    uint8_t nonce[PACKET_NONCE_SIZE];
+    make_nonce(nonce, packet_number_++);
+    EVP_CIPHER_CTX* ctx = seal_ctx_.get();
+    int n = 0;
+    EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce);
+    EVP_EncryptUpdate(ctx, nullptr, &n, out, PACKET_HEADER_SIZE);
+    EVP_EncryptUpdate(ctx, out + PACKET_HEADER_SIZE, &n, prefix, static_cast<int>(prefix_length));
+    if (payload_length > 0) {
+        EVP_EncryptUpdate(ctx, out + PACKET_HEADER_SIZE + prefix_length, &n, payload, static_cast<int>(payload_length));
+    }
+    EVP_EncryptFinal_ex(ctx, out + PACKET_HEADER_SIZE + body_length, &n);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, PACKET_TAG_SIZE, out + PACKET_HEADER_SIZE + body_length);
+    transport_.send(std::move(packet), remote_);
+}
+
+void DatagramChannel::handle_packet(const uint8_t* data, size_t length) {
+    if (!connected_ || closed_) {
+        return;
+    }
+    size_t body_length = length - PACKET_HEADER_SIZE - PACKET_TAG_SIZE;
+    uint8_t nonce[PACKET_NONCE_SIZE];
+    make_nonce(nonce, get64(data + 4));
+    EVP_CIPHER_CTX* ctx = open_ctx_.get();
+    int n = 0;
+    EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, nonce);
+    EVP_DecryptUpdate(ctx, nullptr, &n, data, PACKET_HEADER_SIZE);
+    EVP_DecryptUpdate(ctx, plain_buffer_.data(), &n, data + PACKET_HEADER_SIZE, static_cast<int>(body_length));
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, PACKET_TAG_SIZE,
+                        const_cast<uint8_t*>(data + PACKET_HEADER_SIZE + body_length));
+    if (EVP_DecryptFinal_ex(ctx, plain_buffer_.data() + n, &n) <= 0) {
+        ++transport_.stats_.packets_rejected;
+        return;
+    }
+
+    const uint8_t* body = plain_buffer_.data();
+    switch (body[0]) {
+    case DATA:
+        handle_data(body, body_length);
+        break;
+    case ACK:
+        handle_ack(body, body_length);
+        break;
+    case PING:
+        if (body_length >= 5) {
+            uint8_t pong[9] = {PONG};
+            std::memcpy(pong + 1, body + 1, 4);
+            put32(pong + 5, static_cast<uint32_t>(free_window()));
+            send_packet(pong, sizeof(pong));
+        }
+        break;
+    case PONG:
+        if (body_length >= 9) {
+            update_rtt(transport_.timestamp() - get32(body + 1));
+            peer_window_ = get32(body + 5);
+            if (!established_) {
+                established_ = true;
+                std::cout << "[Datagram] Channel to " << remote_ << " established, rtt="
+                          << srtt_us_ / 1000 << "ms" << std::endl;
+            }
+            flush();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// --- Sender ---
+
+void DatagramChannel::flush() {
+    if (!connected_ || closed_) {
+        return;
+    }
+    size_t window = std::min(cwnd_, peer_window_);
+
+    // Repairs go out before new data
+    while (!lost_.empty()) {
+        auto it = unacked_.find(*lost_.begin());
+        size_t length = it->second.payload.size();
+        if (bytes_in_flight_ + length > window) {
+            break;
+        }
+        lost_.erase(lost_.begin());
+        bytes_in_flight_ += length;
+        ++retransmits_;
+        ++transport_.stats_.retransmits;
+        transmit(it->first, it->second);
+    }
+
+    while (unsent_bytes_ > 0) {
+        size_t length = std::min(DATAGRAM_MSS, unsent_bytes_);
+        if (bytes_in_flight_ + length > window) {
+            break;
+        }
+        // A segment may run across frames
+        PooledBuffer payload = BufferPool::instance().acquire(length);
+        size_t filled = 0;
+        while (filled < length) {
+            auto& frame = frames_.front();
+            size_t head_size = frame.first.head.size();
+            const uint8_t* source = frame_offset_ < head_size ? frame.first.head.data() + frame_offset_
+                                                              : frame.first.payload + (frame_offset_ - head_size);
+            size_t part_end = frame_offset_ < head_size ? head_size : frame.first.size();
+            size_t count = std::min(length - filled, part_end - frame_offset_);
+            std::memcpy(payload.data() + filled, source, count);
+            filled += count;
+            frame_offset_ += count;
+            if (frame_offset_ == frame.first.size()) {
+                if (frame.second) {
+                    boost::asio::post(transport_.io_context_, std::move(frame.second));
+                }
+                frames_.pop_front();
+                frame_offset_ = 0;
+            }
+        }
+        unsent_bytes_ -= length;
+
+        if (unacked_.empty()) {
+            last_progress_at_ = std::chrono::steady_clock::now();
+        }
+        uint64_t seq = next_seq_++;
+        Segment& segment = unacked_[seq];
+        segment.payload = std::move(payload);
+        bytes_in_flight_ += length;
+        transmit(seq, segment);
+    }
+    arm_timer();
+}
+
+void DatagramChannel::transmit(uint64_t seq, Segment& segment) {
+    segment.sent_at = std::chrono::steady_clock::now();
+    uint8_t prefix[DATA_PREFIX_SIZE] = {DATA};
+    put64(prefix + 1, seq);
+    put32(prefix + 9, transport_.timestamp());
+    send_packet(prefix, sizeof(prefix), segment.payload.data(), segment.payload.size());
+}
+
+void DatagramChannel::handle_ack(const uint8_t* body, size_t length) {
+    if (length < ACK_PREFIX_SIZE) {
+        return;
+    }
+    uint64_t cumulative = get64(body + 1);
+    uint32_t window = get32(body + 9);
+    uint32_t delay = get32(body + 13);
+    uint32_t echo = get32(body + 17);
+    size_t blocks = std::min<size_t>(body[21], (length - ACK_PREFIX_SIZE) / 16);
+
+    size_t flight_before = bytes_in_flight_;
+    size_t acked = 0;
+    auto acknowledge = [&](std::map<uint64_t, Segment>::iterator it) {
+        size_t size = it->second.payload.size();
+        if (lost_.erase(it->first) == 0) {
+            bytes_in_flight_ -= size;
+        }
+        if (it->first >= highest_acked_seq_) {
+            highest_acked_seq_ = it->first;
+        }
+        highest_acked_sent_at_ = std::max(highest_acked_sent_at_, it->second.sent_at);
+        acked += size;
+        return unacked_.erase(it);
+    };
+    for (auto it = unacked_.begin(); it != unacked_.end() && it->first < cumulative;) {
+        it = acknowledge(it);
+    }
+    for (size_t i = 0; i < blocks; ++i) {
+        uint64_t start = get64(body + ACK_PREFIX_SIZE + 16 * i);
+        uint64_t end = get64(body + ACK_PREFIX_SIZE + 16 * i + 8);
+        for (auto it = unacked_.lower_bound(start); it != unacked_.end() && it->first < end;) {
+            it = acknowledge(it);
+        }
+    }
+
+    peer_window_ = window;
+    if (acked > 0) {
+        last_progress_at_ = std::chrono::steady_clock::now();
+        if (echo != 0) {
+            update_rtt(transport_.timestamp() - echo);
+        }
+        update_cwnd(acked, flight_before, delay);
+        detect_losses();
+    }
+    flush();
+}
+
+void DatagramChannel::detect_losses() {
+    bool lost_any = false;
+    for (auto& entry : unacked_) {
+        if (entry.first + DATAGRAM_DUP_THRESHOLD > highest_acked_seq_) {
+            break;
+        }
+        // Only segments sent before one that got through count as lost,
+        // so a fresh retransmission is given time to arrive
+        if (entry.second.sent_at >= highest_acked_sent_at_ || !lost_.insert(entry.first).second) {
+            continue;
+        }
+        bytes_in_flight_ -= entry.second.payload.size();
+        lost_any = true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    // Back off at most once per round trip
+    if (lost_any && now - last_loss_at_ > std::chrono::microseconds(static_cast<int64_t>(srtt_us_))) {
+        cwnd_ = ssthresh_ = std::max(cwnd_ / 2, LEDBAT_MIN_CWND);
+        slow_start_ = false;
+        last_loss_at_ = now;
+    }
+}
+
+void DatagramChannel::update_cwnd(size_t bytes_acked, size_t flight_before, uint32_t delay_us) {
+    auto now = std::chrono::steady_clock::now();
+    if (base_delays_.empty() || now - base_minute_start_ >= std::chrono::minutes(1)) {
+        base_delays_.push_back(delay_us);
+        base_minute_start_ = now;
+        if (base_delays_.size() > LEDBAT_BASE_HISTORY) {
+            base_delays_.pop_front();
+        }
+    } else {
+        base_delays_.back() = std::min(base_delays_.back(), delay_us);
+    }
+    current_delays_.push_back(delay_us);
+    if (current_delays_.size() > LEDBAT_CURRENT_FILTER) {
+        current_delays_.pop_front();
+    }
+
+    // Both clocks cancel out: only the growth over the base delay counts
+    uint32_t base = *std::min_element(base_delays_.begin(), base_delays_.end());
+    uint32_t current = *std::min_element(current_delays_.begin(), current_delays_.end());
+    queuing_delay_us_ = std::max<int32_t>(0, static_cast<int32_t>(current - base));
+    double target_us = std::chrono::duration<double, std::micro>(LEDBAT_TARGET).count();
+
+    // Slow start (not part of RFC 6817) reaches a useful window within a few
+    // round trips; it ends at the first loss or once delay starts building
+    if (slow_start_ && (queuing_delay_us_ > target_us / 2 || cwnd_ >= ssthresh_)) {
+        slow_start_ = false;
+    }
+    double cwnd = static_cast<double>(cwnd_);
+    if (slow_start_) {
+        cwnd += bytes_acked;
+    } else {
+        double off_target = (target_us - queuing_delay_us_) / target_us;
+        cwnd += LEDBAT_GAIN * off_target * bytes_acked * DATAGRAM_MSS / cwnd;
+    }
+    double max_allowed = static_cast<double>(flight_before + LEDBAT_ALLOWED_INCREASE * DATAGRAM_MSS);
+    cwnd_ = static_cast<size_t>(std::max(std::min(cwnd, max_allowed), static_cast<double>(LEDBAT_MIN_CWND)));
+}
+
+void DatagramChannel::update_rtt(uint32_t rtt_us) {
+    double sample = rtt_us;
+    if (srtt_us_ == 0) {
+        srtt_us_ = sample;
+        rttvar_us_ = sample / 2;
+    } else {
+        rttvar_us_ = 0.75 * rttvar_us_ + 0.25 * std::abs(srtt_us_ - sample);
+        srtt_us_ = 0.875 * srtt_us_ + 0.125 * sample;
+    }
+    auto rto = std::chrono::microseconds(static_cast<int64_t>(srtt_us_ + 4 * rttvar_us_));
+    rto_ = std::clamp<std::chrono::microseconds>(rto, DATAGRAM_MIN_RTO, DATAGRAM_MAX_RTO);
+}
+
+// --- Receiver ---
+
+void DatagramChannel::handle_data(const uint8_t* body, size_t length) {
+    if (length <= DATA_PREFIX_SIZE || length - DATA_PREFIX_SIZE > DATAGRAM_MSS) {
+        return;
+    }
+    uint64_t seq = get64(body + 1);
+    uint32_t timestamp = get32(body + 9);
+    const uint8_t* payload = body + DATA_PREFIX_SIZE;
+    size_t payload_length = length - DATA_PREFIX_SIZE;
+
+    if (seq < recv_next_ || out_of_order_.count(seq)) {
+        send_ack(); // Our ACK was lost
+        return;
+    }
+    if (payload_length > free_window()) {
+        return; // No room; the sender retries once the window opens
+    }
+    last_delay_ = transport_.timestamp() - timestamp;
+    last_data_timestamp_ = timestamp;
+
+    bool in_order = seq == recv_next_;
+    if (in_order) {
+        stream_.insert(stream_.end(), payload, payload + payload_length);
+        ++recv_next_;
+        while (!out_of_order_.empty() && out_of_order_.begin()->first == recv_next_) {
+            const PooledBuffer& next = out_of_order_.begin()->second;
+            stream_.insert(stream_.end(), next.data(), next.data() + next.size());
+            out_of_order_bytes_ -= next.size();
+            out_of_order_.erase(out_of_order_.begin());
+            ++recv_next_;
+        }
+    } else {
+        PooledBuffer segment = BufferPool::instance().acquire(payload_length);
+        std::memcpy(segment.data(), payload, payload_length);
+        out_of_order_bytes_ += payload_length;
+        out_of_order_.emplace(seq, std::move(segment));
+    }
+
+    deliver();
+    if (closed_) {
+        return;
+    }
+    // Gaps are reported right away so the sender can repair them
+    if (!in_order || !out_of_order_.empty() || ++unacked_packets_ >= 2) {
+        send_ack();
+    } else if (!ack_pending_) {
+        ack_pending_ = true;
+        ack_deadline_ = std::chrono::steady_clock::now() + DATAGRAM_DELAYED_ACK;
+        arm_timer();
+    }
+}
+
+void DatagramChannel::deliver() {
+    while (!paused_ && !closed_) {
+        size_t available = stream_.size() - stream_offset_;
+        if (available < 4) {
+            break;
+        }
+        const uint8_t* frame = stream_.data() + stream_offset_;
+        uint32_t frame_length = get32(frame);
+        if (frame_length > DATAGRAM_MAX_FRAME_SIZE) {
+            fail("frame too large");
+            return;
+        }
+        if (available < 4 + frame_length) {
+            break;
+        }
+        stream_offset_ += 4 + frame_length;
+        if (frame_handler_) {
+            frame_handler_(frame + 4, frame_length);
+        }
+    }
+    if (stream_offset_ == stream_.size()) {
+        stream_.clear();
+        stream_offset_ = 0;
+    } else if (stream_offset_ > stream_.size() / 2) {
+        stream_.erase(stream_.begin(), stream_.begin() + stream_offset_);
+        stream_offset_ = 0;
+    }
+}
+
+size_t DatagramChannel::free_window() const {
+    size_t buffered = out_of_order_bytes_ + stream_.size() - stream_offset_;
+    return DATAGRAM_RECV_WINDOW - std::min(buffered, DATAGRAM_RECV_WINDOW);
+}
+
+void DatagramChannel::send_ack() {
+    uint8_t ack[ACK_PREFIX_SIZE + DATAGRAM_MAX_SACK_BLOCKS * 16] = {ACK};
+    put64(ack + 1, recv_next_);
+    put32(ack + 9, static_cast<uint32_t>(free_window()));
+    put32(ack + 13, last_delay_);
+    put32(ack + 17, last_data_timestamp_);
+
+    // Runs of consecutive out-of-order segments, lowest first
+    size_t blocks = 0;
+    for (auto it = out_of_order_.begin(); it != out_of_order_.end() && blocks < DATAGRAM_MAX_SACK_BLOCKS;) {
+        uint64_t start = it->first;
+        uint64_t end = start + 1;
+        for (++it; it != out_of_order_.end() && it->first == end; ++it) {
+            ++end;
+        }
+        put64(ack + ACK_PREFIX_SIZE + 16 * blocks, start);
+        put64(ack + ACK_PREFIX_SIZE + 16 * blocks + 8, end);
+        ++blocks;
+    }
+    ack[21] = static_cast<uint8_t>(blocks);
+    send_packet(ack, ACK_PREFIX_SIZE + 16 * blocks);
+    ack_pending_ = false;
+    unacked_packets_ = 0;
+}
+
+// --- Timers ---
+
+void DatagramChannel::arm_timer() {
+    bool probing = connected_ && !established_ && probes_sent_ <= DATAGRAM_PROBE_ATTEMPTS;
+    if (timer_armed_ || closed_ || !connected_ ||
+        !(probing || ack_pending_ || !unacked_.empty() || unsent_bytes_ > 0)) {
+        return;
+    }
+    timer_armed_ = true;
+    timer_.expires_after(DATAGRAM_TICK);
+    timer_.async_wait([weak = std::weak_ptr<DatagramChannel>(shared_from_this())](const boost::system::error_code& ec) {
+        auto self = weak.lock();
+        if (!ec && self) {
+            self->on_tick();
+        }
+    });
+}
+
+void DatagramChannel::on_tick() {
+    timer_armed_ = false;
+    if (closed_) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+
+    if (ack_pending_ && now >= ack_deadline_) {
+        send_ack();
+    }
+
+    if (!established_ && probes_sent_ <= DATAGRAM_PROBE_ATTEMPTS && now - last_probe_at_ >= DATAGRAM_PROBE_INTERVAL) {
+        if (probes_sent_ == DATAGRAM_PROBE_ATTEMPTS) {
+            std::cerr << "[Datagram] No answer from " << remote_ << ", chunks stay on TLS/TCP" << std::endl;
+        } else {
+            uint8_t ping[5] = {PING};
+            put32(ping + 1, transport_.timestamp());
+            send_packet(ping, sizeof(ping));
+            last_probe_at_ = now;
+        }
+        ++probes_sent_;
+    }
+
+    if (!unacked_.empty()) {
+        if (now - last_progress_at_ > DATAGRAM_DEAD_TIMEOUT) {
+            fail("peer stopped acknowledging");
+            return;
+        }
+        // Retransmission timeout: presume everything outstanding lost and
+        // start over from the minimum window
+        if (now - unacked_.begin()->second.sent_at > rto_ && now - last_progress_at_ > rto_) {
+            for (auto& entry : unacked_) {
+                if (lost_.insert(entry.first).second) {
+                    bytes_in_flight_ -= entry.second.payload.size();
+                }
+            }
+            ssthresh_ = std::max(cwnd_ / 2, LEDBAT_MIN_CWND);
+            cwnd_ = LEDBAT_MIN_CWND;
+            slow_start_ = true;
+            ++timeouts_;
+            rto_ = std::min<std::chrono::microseconds>(rto_ * 2, DATAGRAM_MAX_RTO);
+            flush();
+        }
+    } else if (unsent_bytes_ > 0 && peer_window_ < DATAGRAM_MSS && now - last_probe_at_ >= rto_) {
+        // Zero window: the PONG carries the current one
+        uint8_t ping[5] = {PING};
+        put32(ping + 1, transport_.timestamp());
+        send_packet(ping, sizeof(ping));
+        last_probe_at_ = now;
+    }
+    arm_timer();
+}
+
+void DatagramChannel::fail(const char* reason) {
+    std::cerr << "[Datagram] Channel to " << remote_ << " failed: " << reason << std::endl;
+    auto handler = std::move(failure_handler_);
+    close();
+    if (handler) {
+        handler();
+    }
+}
+
+} // namespace aura
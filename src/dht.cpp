@@ -2,6 +2,7 @@
 #include "aura/dht_utils.hpp"
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 #include <vector>
 #include <map>
 
@@ -68,17 +69,35 @@ std::vector<DhtPeer> RoutingTable::find_closest_peers(const std::string& target_
     return all_peers;
 }
 
+size_t RoutingTable::count_closer_peers(const std::string& target_id, const std::string& peer_id) const {
+    auto reference = dht::xor_distance(peer_id, target_id);
+    size_t closer = 0;
+    for (const auto& bucket : buckets_) {
+        for (const auto& peer : bucket.get_peers()) {
+            if (dht::xor_distance(peer.id, target_id) < reference) {
+                ++closer;
+            }
+        }
+    }
+    return closer;
+}
+
 // --- DhtNode ---
 DhtNode::DhtNode(boost::asio::io_context& io_context, unsigned short port, const std::string& self_id)
     : io_context_(io_context),
       socket_(io_context, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port)),
       routing_table_(self_id),
-      recv_buffer_(4096)
+      recv_buffer_(DHT_RECV_BUFFER_SIZE),
+      arena_(make_arena_options(arena_block_.data(), arena_block_.size())),
+      serve_timer_(io_context)
 {
+    serve_bucket_.tokens = DHT_SERVE_BURST;
+    serve_bucket_.updated = Clock::now();
     std::cout << "[DHT] Listening on UDP port " << port << std::endl;
 }
 
 void DhtNode::start() {
+    socket_.non_blocking(true);
     do_receive();
 }
 
@@ -95,54 +114,577 @@ void DhtNode::find_node(const std::string& target_id, std::function<void(const s
 
 void DhtNode::store_value(const std::string& key, const PeerInfo& provider) {
     std::cout << "[DHT] Storing value for key " << dht::to_hex(key) << " on the network..." << std::endl;
+
+    // Keep our own record too, so lookups that reach us are answered directly
+    store_local(key, provider, 0);
     
     find_node(key, [this, key, provider](const std::vector<DhtPeer>& closest_peers) {
         std::cout << "[DHT] Found " << closest_peers.size() << " peers to store value. Sending requests..." << std::endl;
-        
-        MessageWrapper msg;
-        auto* store_req = msg.mutable_store_value_req();
-        store_req->set_sender_id(routing_table_.get_self_id());
-        store_req->set_key(key);
-        *store_req->mutable_provider() = provider;
-
         for (const auto& peer : closest_peers) {
-            send(msg, peer.endpoint);
+            send_store(key, provider, 0, peer.endpoint);
         }
     });
 }
 
+void DhtNode::send_store(const std::string& key, const PeerInfo& provider, uint32_t ttl,
+                         const boost::asio::ip::udp::endpoint& target) {
+    MessageWrapper msg;
+    auto* store_req = msg.mutable_store_value_req();
+    store_req->set_sender_id(routing_table_.get_self_id());
+    store_req->set_key(key);
+    *store_req->mutable_provider() = provider;
+    store_req->set_ttl(ttl);
+    send(msg, target);
+}
+
+void DhtNode::store_local(const std::string& key, const PeerInfo& provider, uint32_t ttl) {
+    auto& providers = storage_[key];
+    auto it = std::find_if(providers.begin(), providers.end(), [&](const StoredProvider& p) {
+        return p.info.peer_id() == provider.peer_id();
+    });
+    if (it == providers.end()) {
+        providers.push_back({provider, std::string(), false, Clock::time_point()});
+        it = providers.end() - 1;
+    } else {
+        it->info = provider;
+        it->compact.clear();
+        // A permanent record is never downgraded by a cached copy
+        if (!it->expires && ttl != 0) {
+            return;
+        }
+    }
+    it->expires = ttl != 0;
+    it->expires_at = Clock::now() + std::chrono::seconds(ttl);
+
+    // Encode once here instead of on every FindValueRequest
+    boost::system::error_code ec;
+    auto address = boost::asio::ip::make_address(provider.address(), ec);
+    if (!ec && provider.peer_id().size() == dht::NODE_ID_SIZE) {
+        it->compact = dht::encode_compact_node(provider.peer_id(), address, static_cast<uint16_t>(provider.port()));
+    }
+}
+
+std::vector<PeerInfo> DhtNode::get_providers(const std::string& key) {
+    std::vector<PeerInfo> result;
+    auto it = storage_.find(key);
+    if (it == storage_.end()) {
+        return result;
+    }
+
+    auto now = Clock::now();
+    auto& providers = it->second;
+    providers.erase(std::remove_if(providers.begin(), providers.end(), [now](const StoredProvider& p) {
+        return p.expires && p.expires_at <= now;
+    }), providers.end());
+
+    if (providers.empty()) {
+        storage_.erase(it);
+        key_activity_.erase(key);
+        return result;
+    }
+
+    result.reserve(providers.size());
+    for (const auto& provider : providers) {
+        result.push_back(provider.info);
+    }
+    return result;
+}
+
 void DhtNode::find_value(const std::string& key, std::function<void(const std::vector<PeerInfo>&)> callback) {
-    if (storage_.count(key)) {
-        boost::asio::post(io_context_, [callback, providers = storage_.at(key)]() {
+    auto providers = get_providers(key);
+    if (!providers.empty()) {
+        boost::asio::post(io_context_, [callback, providers]() {
             callback(providers);
         });
-    } else {
-        // TODO: Iterative find_value
+        return;
+    }
+
+    // Join a lookup that is already running for this key
+    auto pending = pending_find_value_.find(key);
+    if (pending != pending_find_value_.end()) {
+        pending->second->callbacks.push_back(std::move(callback));
+        return;
+    }
+
+    auto closest = routing_table_.find_closest_peers(key, K_BUCKET_SIZE);
+    if (closest.empty()) {
         boost::asio::post(io_context_, [callback](){ callback({}); });
+        return;
     }
+
+    std::cout << "[DHT] Starting lookup for key " << dht::to_hex(key) << " with " << closest.size() << " candidates" << std::endl;
+    auto lookup = std::make_unique<ValueLookup>();
+    lookup->span = trace::Span::begin("dht", "find_value lookup");
+    lookup->callbacks.push_back(std::move(callback));
+    lookup->candidates = closest;
+    for (const auto& peer : closest) {
+        lookup->seen.push_back(peer.id);
+    }
+    lookup->query_timer = std::make_unique<boost::asio::steady_timer>(io_context_);
+    lookup->timer = std::make_unique<boost::asio::steady_timer>(io_context_, std::chrono::seconds(5));
+    lookup->timer->async_wait([this, key](const boost::system::error_code& ec) {
+        if (!ec) {
+            std::cout << "[DHT] Lookup for key " << dht::to_hex(key) << " timed out." << std::endl;
+            auto it = pending_find_value_.find(key);
+            if (it != pending_find_value_.end()) {
+                // Keep whatever provider parts made it
+                finish_lookup(key, it->second->found);
+            }
+        }
+    });
+    pending_find_value_[key] = std::move(lookup);
+    continue_lookup(key);
 }
 
-void DhtNode::do_receive() {
-    auto sender_endpoint = std::make_shared<boost::asio::ip::udp::endpoint>();
-    socket_.async_receive_from(
-        boost::asio::buffer(recv_buffer_), *sender_endpoint,
-        [this, sender_endpoint](boost::system::error_code ec, std::size_t length) {
-            if (!ec && length > 0) {
-                MessageWrapper msg;
-                if (msg.ParseFromArray(recv_buffer_.data(), length)) {
-                    handle_message(msg, *sender_endpoint);
-                }
+void DhtNode::continue_lookup(const std::string& key) {
+    auto it = pending_find_value_.find(key);
+    if (it == pending_find_value_.end()) {
+        return;
+    }
+    auto& lookup = *it->second;
+    if (lookup.parts_expected > 0) {
+        return; // Providers found, waiting for the remaining parts
+    }
+
+    while (lookup.in_flight.size() < LOOKUP_ALPHA && !lookup.candidates.empty() &&
+           lookup.queried < LOOKUP_MAX_QUERIES) {
+        DhtPeer peer = lookup.candidates.front();
+        lookup.candidates.erase(lookup.candidates.begin());
+
+        MessageWrapper msg;
+        auto* req = msg.mutable_find_value_req();
+        req->set_sender_id(routing_table_.get_self_id());
+        req->set_key(key);
+        req->set_version(DHT_PROTOCOL_VERSION);
+        send(msg, peer.endpoint);
+
+        lookup.in_flight.push_back({peer, Clock::now() + LOOKUP_QUERY_TIMEOUT});
+        ++lookup.queried;
+    }
+
+    if (lookup.in_flight.empty()) {
+        std::cout << "[DHT] Lookup for key " << dht::to_hex(key) << " exhausted without providers." << std::endl;
+        finish_lookup(key, {});
+        return;
+    }
+
+    auto earliest = std::min_element(lookup.in_flight.begin(), lookup.in_flight.end(),
+        [](const QueriedPeer& a, const QueriedPeer& b) { return a.deadline < b.deadline; });
+    lookup.query_timer->expires_at(earliest->deadline);
+    lookup.query_timer->async_wait([this, key](const boost::system::error_code& ec) {
+        if (!ec) {
+            expire_queries(key);
+        }
+    });
+}
+
+void DhtNode::expire_queries(const std::string& key) {
+    auto it = pending_find_value_.find(key);
+    if (it == pending_find_value_.end()) {
+        return;
+    }
+    auto& lookup = *it->second;
+    auto now = Clock::now();
+    lookup.in_flight.erase(std::remove_if(lookup.in_flight.begin(), lookup.in_flight.end(), [&](const QueriedPeer& q) {
+        if (q.deadline > now) {
+            return false;
+        }
+        std::cout << "[DHT] No answer from " << q.peer.endpoint << " for key " << dht::to_hex(key) << std::endl;
+        return true;
+    }), lookup.in_flight.end());
+    continue_lookup(key);
+}
+
+void DhtNode::finish_lookup(const std::string& key, std::vector<PeerInfo> providers) {
+    auto it = pending_find_value_.find(key);
+    if (it == pending_find_value_.end()) {
+        return;
+    }
+    auto callbacks = std::move(it->second->callbacks);
+    it->second->span.end();
+    pending_find_value_.erase(it);
+
+    for (auto& callback : callbacks) {
+        boost::asio::post(io_context_, [callback, providers]() {
+            callback(providers);
+        });
+    }
+}
+
+void DhtNode::handle_find_value_response(const FindValueResponse& res,
+                                         const boost::asio::ip::udp::endpoint& sender) {
+    auto it = pending_find_value_.find(res.key());
+    if (it == pending_find_value_.end()) {
+        return; // Late answer for a finished lookup
+    }
+    auto& lookup = *it->second;
+    const std::string& key = res.key();
+    bool has_providers = res.has_providers() &&
+        (res.providers().peers_size() > 0 || res.providers().compact_peers_size() > 0);
+
+    // Later parts of a split provider list
+    if (has_providers && lookup.parts_expected > 0) {
+        if (sender != lookup.found_from) {
+            return;
+        }
+        auto providers = decode_providers(res.providers());
+        lookup.found.insert(lookup.found.end(), providers.begin(), providers.end());
+        if (++lookup.parts_received >= lookup.parts_expected) {
+            cache_along_path(key, lookup, lookup.found);
+            finish_lookup(key, lookup.found);
+        }
+        return;
+    }
+
+    auto peer_it = std::find_if(lookup.in_flight.begin(), lookup.in_flight.end(), [&](const QueriedPeer& q) {
+        return q.peer.endpoint == sender;
+    });
+    if (peer_it == lookup.in_flight.end()) {
+        return; // We did not ask this node
+    }
+    DhtPeer peer = peer_it->peer;
+    lookup.in_flight.erase(peer_it);
+    routing_table_.add_peer(peer);
+
+    if (has_providers) {
+        lookup.found = decode_providers(res.providers());
+        lookup.found_from = sender;
+        lookup.parts_expected = std::max<uint32_t>(res.total_parts(), 1);
+        lookup.parts_received = 1;
+        std::cout << "[DHT] Lookup for key " << dht::to_hex(key) << " found " << lookup.found.size()
+                  << " provider(s) in part 1/" << lookup.parts_expected << "." << std::endl;
+        if (lookup.parts_received >= lookup.parts_expected) {
+            cache_along_path(key, lookup, lookup.found);
+            finish_lookup(key, lookup.found);
+        }
+        return;
+    }
+
+    lookup.without_value.push_back(peer);
+    if (res.has_closer_peers()) {
+        for (const auto& candidate : decode_neighbors(res.closer_peers())) {
+            if (candidate.id == routing_table_.get_self_id() ||
+                std::find(lookup.seen.begin(), lookup.seen.end(), candidate.id) != lookup.seen.end()) {
+                continue;
+            }
+            routing_table_.add_peer(candidate);
+            lookup.candidates.push_back(candidate);
+            lookup.seen.push_back(candidate.id);
+        }
+
+        std::sort(lookup.candidates.begin(), lookup.candidates.end(), [&key](const DhtPeer& a, const DhtPeer& b) {
+            return dht::xor_distance(a.id, key) < dht::xor_distance(b.id, key);
+        });
+    }
+
+    continue_lookup(key);
+}
+
+void DhtNode::add_neighbors(FindNodeResponse* res, const std::vector<DhtPeer>& peers, uint32_t version) {
+    for (const auto& peer : peers) {
+        if (version >= 2) {
+            res->add_compact_neighbors(dht::encode_compact_node(peer.id, peer.endpoint.address(), peer.endpoint.port()));
+        } else {
+            auto* peer_info = res->add_neighbors();
+            peer_info->set_address(peer.endpoint.address().to_string());
+            peer_info->set_port(peer.endpoint.port());
+            peer_info->set_peer_id(peer.id);
+        }
+    }
+}
+
+std::vector<DhtPeer> DhtNode::decode_neighbors(const FindNodeResponse& res) {
+    std::vector<DhtPeer> peers;
+    for (const auto& entry : res.compact_neighbors()) {
+        std::string id;
+        boost::asio::ip::address address;
+        uint16_t port;
+        if (dht::decode_compact_node(entry, id, address, port)) {
+            peers.push_back({id, boost::asio::ip::udp::endpoint(address, port)});
+        }
+    }
+    // Version 1 senders
+    for (const auto& peer_info : res.neighbors()) {
+        if (peer_info.peer_id().empty()) {
+            continue;
+        }
+        boost::system::error_code ec;
+        auto address = boost::asio::ip::make_address(peer_info.address(), ec);
+        if (!ec) {
+            peers.push_back({peer_info.peer_id(), boost::asio::ip::udp::endpoint(address, peer_info.port())});
+        }
+    }
+    return peers;
+}
+
+std::vector<PeerInfo> DhtNode::decode_providers(const PeerList& list) {
+    std::vector<PeerInfo> providers(list.peers().begin(), list.peers().end());
+    for (const auto& entry : list.compact_peers()) {
+        std::string id;
+        boost::asio::ip::address address;
+        uint16_t port;
+        if (dht::decode_compact_node(entry, id, address, port)) {
+            PeerInfo info;
+            info.set_address(address.to_string());
+            info.set_port(port);
+            info.set_peer_id(id);
+            providers.push_back(std::move(info));
+        }
+    }
+    return providers;
+}
+
+void DhtNode::send_providers(const std::string& key, uint32_t version, const boost::asio::ip::udp::endpoint& target) {
+    for (const auto& part : pack_providers(key, routing_table_.get_self_id(), storage_.at(key), version)) {
+        send(part, target);
+    }
+}
+
+std::vector<MessageWrapper> DhtNode::pack_providers(const std::string& key, const std::string& sender_id,
+                                                    const std::vector<StoredProvider>& providers, uint32_t version) {
+    std::vector<MessageWrapper> parts(1);
+    auto new_part = [&](MessageWrapper& part) {
+        auto* res = part.mutable_find_value_res();
+        res->set_key(key);
+        res->set_sender_id(sender_id);
+        res->mutable_providers();
+    };
+    new_part(parts.back());
+
+    // Fill datagrams up to MAX_DATAGRAM_PAYLOAD; the trailing part/total_parts
+    // fields add at most 12 bytes, which the margin below absorbs.
+    const size_t budget = MAX_DATAGRAM_PAYLOAD - 16;
+    for (const auto& stored : providers) {
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            auto* list = parts.back().mutable_find_value_res()->mutable_providers();
+            bool compact = version >= 2 && !stored.compact.empty();
+            if (compact) {
+                list->add_compact_peers(stored.compact);
+            } else {
+                *list->add_peers() = stored.info;
             }
-            do_receive();
+            bool alone = list->peers_size() + list->compact_peers_size() == 1;
+            if (parts.back().ByteSizeLong() <= budget || alone) {
+                break;
+            }
+            // Does not fit, move the entry into a fresh datagram
+            if (compact) {
+                list->mutable_compact_peers()->RemoveLast();
+            } else {
+                list->mutable_peers()->RemoveLast();
+            }
+            parts.emplace_back();
+            new_part(parts.back());
+        }
+    }
+
+    for (size_t i = 0; i < parts.size(); ++i) {
+        auto* res = parts[i].mutable_find_value_res();
+        res->set_part(static_cast<uint32_t>(i));
+        res->set_total_parts(static_cast<uint32_t>(parts.size()));
+    }
+    return parts;
+}
+
+void DhtNode::cache_along_path(const std::string& key, const ValueLookup& lookup,
+                               const std::vector<PeerInfo>& providers) {
+    if (lookup.without_value.empty()) {
+        return;
+    }
+
+    // The closest node that answered without the value is the one the next
+    // lookup for this key is most likely to reach first.
+    auto target = std::min_element(lookup.without_value.begin(), lookup.without_value.end(),
+        [&key](const DhtPeer& a, const DhtPeer& b) {
+            return dht::xor_distance(a.id, key) < dht::xor_distance(b.id, key);
         });
+
+    size_t closer = routing_table_.count_closer_peers(key, target->id);
+    auto ttl = CACHE_TTL_MAX.count() >> std::min<size_t>(closer, 16);
+    ttl = std::max<long long>(ttl, CACHE_TTL_MIN.count());
+
+    std::cout << "[DHT] Caching " << providers.size() << " provider(s) for key " << dht::to_hex(key)
+              << " at " << target->endpoint << " for " << ttl << "s" << std::endl;
+    for (const auto& provider : providers) {
+        send_store(key, provider, static_cast<uint32_t>(ttl), target->endpoint);
+    }
+}
+
+void DhtNode::record_key_request(const std::string& key) {
+    auto now = Clock::now();
+    auto& activity = key_activity_[key];
+    if (now - activity.window_start > HOT_KEY_WINDOW) {
+        activity.window_start = now;
+        activity.requests = 0;
+        activity.replicated = false;
+    }
+    ++activity.requests;
+
+    if (activity.requests <= HOT_KEY_THRESHOLD || activity.replicated) {
+        return;
+    }
+    activity.replicated = true;
+
+    auto providers = get_providers(key);
+    auto targets = routing_table_.find_closest_peers(key, HOT_KEY_REPLICAS);
+    std::cout << "[DHT] Key " << dht::to_hex(key) << " is hot (" << activity.requests
+              << " requests). Replicating to " << targets.size() << " nodes." << std::endl;
+    for (const auto& peer : targets) {
+        for (const auto& provider : providers) {
+            send_store(key, provider, static_cast<uint32_t>(CACHE_TTL_MAX.count()), peer.endpoint);
+        }
+    }
+}
+
+void DhtNode::do_receive() {
+    socket_.async_wait(boost::asio::ip::udp::socket::wait_read, [this](boost::system::error_code ec) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            read_datagrams();
+        }
+        do_receive();
+    });
+}
+
+void DhtNode::read_datagrams() {
+    auto now = Clock::now();
+    for (size_t i = 0; i < DHT_BATCH_SIZE; ++i) {
+        boost::system::error_code ec;
+        size_t length = socket_.receive_from(boost::asio::buffer(recv_buffer_), recv_endpoint_, 0, ec);
+        if (ec) {
+            break; // Usually would_block: the socket is drained
+        }
+        auto* msg = google::protobuf::Arena::CreateMessage<MessageWrapper>(&arena_);
+        if (length > 0 && msg->ParseFromArray(recv_buffer_.data(), static_cast<int>(length))) {
+            if (msg->has_find_node_req() || msg->has_find_value_req() || msg->has_store_value_req()) {
+                admit_request(recv_endpoint_, length, now);
+            } else if (is_expected_response(*msg, recv_endpoint_)) {
+                ++stats_.responses;
+                handle_message(*msg, recv_endpoint_);
+            } else if (take_source_token(recv_endpoint_.address(), now)) {
+                ++stats_.unsolicited;
+            } else {
+                ++stats_.requests_limited;
+            }
+        }
+        BufferPool::instance().record_arena_parse(arena_.SpaceUsed());
+        arena_.Reset();
+    }
+    serve_requests();
+}
+
+bool DhtNode::is_expected_response(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& sender) {
+    if (msg.has_find_value_res()) {
+        auto it = pending_find_value_.find(msg.find_value_res().key());
+        if (it == pending_find_value_.end()) {
+            return false;
+        }
+        const auto& lookup = *it->second;
+        return (lookup.parts_expected > 0 && sender == lookup.found_from) ||
+               std::any_of(lookup.in_flight.begin(), lookup.in_flight.end(),
+                           [&](const QueriedPeer& q) { return q.peer.endpoint == sender; });
+    }
+    if (msg.has_find_node_res()) {
+        auto it = find_node_queries_.find(sender);
+        if (it == find_node_queries_.end()) {
+            return false;
+        }
+        if (it->second < Clock::now()) {
+            find_node_queries_.erase(it); // Too late
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool DhtNode::TokenBucket::try_take(double rate, double burst, Clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - updated).count();
+    tokens = std::min(burst, tokens + elapsed * rate);
+    updated = now;
+    if (tokens < 1) {
+        return false;
+    }
+    tokens -= 1;
+    return true;
+}
+
+bool DhtNode::take_source_token(const boost::asio::ip::address& source, Clock::time_point now) {
+    auto it = source_buckets_.find(source);
+    if (it == source_buckets_.end()) {
+        // A new source is never refused: the one seen least recently makes room
+        if (source_buckets_.size() >= DHT_MAX_SOURCES) {
+            source_buckets_.erase(source_lru_.front());
+            source_lru_.pop_front();
+            ++stats_.sources_evicted;
+        }
+        source_lru_.push_back(source);
+        it = source_buckets_.emplace(source, SourceBucket{TokenBucket{DHT_SOURCE_BURST, now},
+                                                          std::prev(source_lru_.end())}).first;
+    } else {
+        source_lru_.splice(source_lru_.end(), source_lru_, it->second.lru);
+    }
+    return it->second.bucket.try_take(DHT_SOURCE_RATE, DHT_SOURCE_BURST, now);
+}
+
+void DhtNode::admit_request(const boost::asio::ip::udp::endpoint& sender, size_t length, Clock::time_point now) {
+    if (!take_source_token(sender.address(), now)) {
+        ++stats_.requests_limited;
+        return;
+    }
+    if (request_queue_.size() >= DHT_MAX_QUEUED_REQUESTS) {
+        ++stats_.requests_shed;
+        return;
+    }
+    PooledBuffer datagram = BufferPool::instance().acquire(length);
+    std::memcpy(datagram.data(), recv_buffer_.data(), length);
+    request_queue_.push_back({std::move(datagram), sender, now});
+}
+
+void DhtNode::serve_requests() {
+    auto now = Clock::now();
+    for (size_t i = 0; i < DHT_BATCH_SIZE && !request_queue_.empty(); ++i) {
+        if (!serve_bucket_.try_take(DHT_SERVE_RATE, DHT_SERVE_BURST, now)) {
+            break;
+        }
+        QueuedRequest request = std::move(request_queue_.front());
+        request_queue_.pop_front();
+        double waited_ms = std::chrono::duration<double, std::milli>(now - request.received_at).count();
+        stats_.queue_delay_ms = 0.9 * stats_.queue_delay_ms + 0.1 * waited_ms;
+        ++stats_.requests_served;
+
+        auto* msg = google::protobuf::Arena::CreateMessage<MessageWrapper>(&arena_);
+        if (msg->ParseFromArray(request.datagram.data(), static_cast<int>(request.datagram.size()))) {
+            handle_message(*msg, request.sender);
+        }
+        arena_.Reset();
+    }
+    if (request_queue_.empty() || serve_scheduled_) {
+        return;
+    }
+    // Come back once a token is due, letting other handlers run in between
+    double wait = std::max(0.0, (1 - serve_bucket_.tokens) / DHT_SERVE_RATE);
+    serve_scheduled_ = true;
+    serve_timer_.expires_after(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(wait)));
+    serve_timer_.async_wait([this](const boost::system::error_code& ec) {
+        serve_scheduled_ = false;
+        if (!ec) {
+            serve_requests();
+        }
+    });
 }
 
 void DhtNode::send(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& target) {
-    auto serialized_msg = std::make_shared<std::string>();
-    msg.SerializeToString(serialized_msg.get());
+    size_t size = msg.ByteSizeLong();
+    PooledBuffer datagram = BufferPool::instance().acquire(size);
+    msg.SerializeWithCachedSizesToArray(datagram.data());
     std::cout << "[DHT Send] Sending message to " << target << std::endl;
-    socket_.async_send_to(boost::asio::buffer(*serialized_msg), target,
-        [serialized_msg](boost::system::error_code /*ec*/, std::size_t /*bytes_sent*/) {});
+    auto buffer = boost::asio::buffer(datagram.data(), datagram.size());
+    // The datagram returns to the pool once the send completes
+    socket_.async_send_to(buffer, target,
+        [datagram = std::move(datagram)](boost::system::error_code /*ec*/, std::size_t /*bytes_sent*/) {});
 }
 
 void DhtNode::bootstrap(const std::string& host, unsigned short port) {
@@ -153,14 +695,21 @@ void DhtNode::bootstrap(const std::string& host, unsigned short port) {
     auto* find_req = msg.mutable_find_node_req();
     find_req->set_sender_id(routing_table_.get_self_id());
     find_req->set_target_id(routing_table_.get_self_id());
+    find_req->set_version(DHT_PROTOCOL_VERSION);
 
+    auto now = Clock::now();
+    for (auto it = find_node_queries_.begin(); it != find_node_queries_.end();) {
+        it = it->second < now ? find_node_queries_.erase(it) : std::next(it);
+    }
+    find_node_queries_[bootstrap_endpoint] = now + FIND_NODE_QUERY_TIMEOUT;
     send(msg, bootstrap_endpoint);
 }
 
 void DhtNode::handle_message(const MessageWrapper& msg, const boost::asio::ip::udp::endpoint& sender) {
     std::cout << "[DHT Recv] Received message from " << sender << std::endl;
     std::string sender_id;
-    // Сначала извлекаем ID отправителя из любого типа сообщения
+    // Сначала извлекаем ID отправителя из любого типа сообщения.
+    // A responder is added below, once its response is matched to our query.
     if (msg.has_find_node_req()) sender_id = msg.find_node_req().sender_id();
     else if (msg.has_find_value_req()) sender_id = msg.find_value_req().sender_id();
     else if (msg.has_store_value_req()) sender_id = msg.store_value_req().sender_id();
@@ -173,18 +722,22 @@ void DhtNode::handle_message(const MessageWrapper& msg, const boost::asio::ip::u
     }
 
     // --- Обработка ОТВЕТОВ на наши запросы ---
+    if (msg.has_find_value_res()) {
+        std::cout << "[DHT] Handling FindValueResponse." << std::endl;
+        handle_find_value_response(msg.find_value_res(), sender);
+        return;
+    }
+
     if (msg.has_find_node_res()) {
         std::cout << "[DHT] Handling FindNodeResponse." << std::endl;
-        for (const auto& peer_info : msg.find_node_res().neighbors()) {
-            if (!peer_info.peer_id().empty()) {
-                routing_table_.add_peer({
-                    peer_info.peer_id(),
-                    boost::asio::ip::udp::endpoint(
-                        boost::asio::ip::address::from_string(peer_info.address()),
-                        peer_info.port()
-                    )
-                });
-            }
+        if (find_node_queries_.erase(sender) == 0) {
+            return; // Not asked, or already answered
+        }
+        if (!msg.find_node_res().sender_id().empty()) {
+            routing_table_.add_peer({msg.find_node_res().sender_id(), sender});
+        }
+        for (const auto& peer : decode_neighbors(msg.find_node_res())) {
+            routing_table_.add_peer(peer);
         }
         return; // Ответы не требуют ответа
     }
@@ -196,45 +749,33 @@ void DhtNode::handle_message(const MessageWrapper& msg, const boost::asio::ip::u
         
         MessageWrapper response;
         auto* find_node_res = response.mutable_find_node_res();
+        find_node_res->set_sender_id(routing_table_.get_self_id());
         auto closest_peers = routing_table_.find_closest_peers(req.target_id(), 8);
         std::cout << "[DHT] Found " << closest_peers.size() << " closest peers in local table to respond with." << std::endl;
-        for (const auto& peer : closest_peers) {
-            auto* peer_info = find_node_res->add_neighbors();
-            peer_info->set_address(peer.endpoint.address().to_string());
-            peer_info->set_port(peer.endpoint.port());
-            peer_info->set_peer_id(peer.id);
-        }
+        add_neighbors(find_node_res, closest_peers, req.version());
         send(response, sender);
 
     } else if (msg.has_find_value_req()) {
         const auto& req = msg.find_value_req();
         std::cout << "[DHT] Handling FindValueRequest for key " << dht::to_hex(req.key()) << std::endl;
         
-        MessageWrapper response;
-        auto* find_value_res = response.mutable_find_value_res();
-        find_value_res->set_key(req.key());
-
-        if (storage_.count(req.key())) {
-            auto* peer_list = find_value_res->mutable_providers();
-            for (const auto& provider : storage_.at(req.key())) {
-                *peer_list->add_peers() = provider;
-            }
+        if (!get_providers(req.key()).empty()) {
+            send_providers(req.key(), req.version(), sender);
+            record_key_request(req.key());
         } else {
-            auto* closer_peers_res = find_value_res->mutable_closer_peers();
-            auto closest_peers = routing_table_.find_closest_peers(req.key(), 8);
-            for (const auto& peer : closest_peers) {
-                auto* peer_info = closer_peers_res->add_neighbors();
-                peer_info->set_address(peer.endpoint.address().to_string());
-                peer_info->set_port(peer.endpoint.port());
-                peer_info->set_peer_id(peer.id);
-            }
+            MessageWrapper response;
+            auto* find_value_res = response.mutable_find_value_res();
+            find_value_res->set_key(req.key());
+            find_value_res->set_sender_id(routing_table_.get_self_id());
+            auto closest_peers = routing_table_.find_closest_peers(req.key(), K_BUCKET_SIZE);
+            add_neighbors(find_value_res->mutable_closer_peers(), closest_peers, req.version());
+            send(response, sender);
         }
-        send(response, sender);
 
     } else if (msg.has_store_value_req()) {
         const auto& req = msg.store_value_req();
         std::cout << "[DHT] Handling StoreValueRequest for key " << dht::to_hex(req.key()) << std::endl;
-        storage_[req.key()].push_back(req.provider());
+        store_local(req.key(), req.provider(), req.ttl());
     }
 }
 
@@ -33,5 +33,38 @@ std::string from_hex(const std::string& hex_s) {
     return result;
 }
 
+std::string encode_compact_node(const std::string& id, const boost::asio::ip::address& address, uint16_t port) {
+    std::string entry = id;
+    if (address.is_v4()) {
+        auto bytes = address.to_v4().to_bytes();
+        entry.append(bytes.begin(), bytes.end());
+    } else {
+        auto bytes = address.to_v6().to_bytes();
+        entry.append(bytes.begin(), bytes.end());
+    }
+    entry.push_back(static_cast<char>(port >> 8));
+    entry.push_back(static_cast<char>(port & 0xff));
+    return entry;
+}
+
+bool decode_compact_node(const std::string& entry, std::string& id,
+                         boost::asio::ip::address& address, uint16_t& port) {
+    const auto* data = reinterpret_cast<const uint8_t*>(entry.data());
+    if (entry.size() == COMPACT_IPV4_SIZE) {
+        boost::asio::ip::address_v4::bytes_type bytes;
+        std::copy(data + NODE_ID_SIZE, data + NODE_ID_SIZE + bytes.size(), bytes.begin());
+        address = boost::asio::ip::address_v4(bytes);
+    } else if (entry.size() == COMPACT_IPV6_SIZE) {
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::copy(data + NODE_ID_SIZE, data + NODE_ID_SIZE + bytes.size(), bytes.begin());
+        address = boost::asio::ip::address_v6(bytes);
+    } else {
+        return false;
+    }
+    id.assign(entry, 0, NODE_ID_SIZE);
+    port = static_cast<uint16_t>((data[entry.size() - 2] << 8) | data[entry.size() - 1]);
+    return true;
+}
+
 } // namespace dht
 } // namespace aura
@@ -0,0 +1,637 @@
+#include "disk_io.hpp"
+#include "file_sharer.hpp"
+#include <boost/asio/thread_pool.hpp>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+
+#ifdef AURA_HAVE_IO_URING
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace aura {
+
+namespace {
+
+// O_DIRECT requires offsets, lengths and buffers aligned to the block size
+const size_t DIRECT_IO_ALIGNMENT = 4096;
+// Registered (fixed) buffers kept by the io_uring backend in O_DIRECT mode
+const unsigned REGISTERED_BUFFER_COUNT = 16;
+
+// Descriptors kept open by a backend; directory shares touch many files
+const size_t MAX_OPEN_FILES = 256;
+
+// An open descriptor, closed once the cache and every request using it let go
+class FileHandle {
+public:
+    explicit FileHandle(int fd) : fd_(fd) {}
+    ~FileHandle() { ::close(fd_); }
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Keeps the most recently used descriptors per (path, mode) open
+class FileHandleCache {
+public:
+    // Null if the file cannot be opened
+    std::shared_ptr<FileHandle> get(const std::string& path, bool writable, bool direct) {
+        std::string key = path + (writable ? "|w" : "|r") + (direct ? "d" : "");
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = handles_.find(key);
+        if (it != handles_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return it->second->second;
+        }
+
+        int flags = (writable ? (O_RDWR | O_CREAT) : O_RDONLY) | O_CLOEXEC;
+#ifdef O_DIRECT
+        if (direct) {
+            flags |= O_DIRECT;
+        }
+#endif
+        int fd = ::open(path.c_str(), flags, 0644);
+        if (fd < 0) {
+            std::cerr << "[Disk] Could not open " << path << ": " << std::strerror(errno) << std::endl;
+            return nullptr;
+        }
+        auto handle = std::make_shared<FileHandle>(fd);
+        lru_.emplace_front(key, handle);
+        handles_[key] = lru_.begin();
+        if (lru_.size() > MAX_OPEN_FILES) {
+            handles_.erase(lru_.back().first);
+            lru_.pop_back();
+        }
+        return handle;
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<FileHandle>>;
+
+    std::mutex mutex_;
+    std::list<Entry> lru_; // Most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> handles_;
+};
+
+// Reads until length bytes, end of file or an error. Returns -1 on error.
+ssize_t pread_full(int fd, uint8_t* buffer, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return static_cast<ssize_t>(done);
+}
+
+bool pwrite_full(int fd, const uint8_t* buffer, size_t length, uint64_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// --- Thread pool backend ---
+class ThreadPoolDiskBackend : public DiskBackend {
+public:
+    ThreadPoolDiskBackend(boost::asio::io_context& io_context, size_t threads)
+        : io_context_(io_context),
+          pool_(threads) {}
+
+    ~ThreadPoolDiskBackend() override {
+        pool_.join();
+    }
+
+    void async_read(const std::string& path, uint64_t offset, size_t length, DiskReadHandler handler) override {
+        boost::asio::post(pool_, [this, path, offset, length, handler = std::move(handler)]() mutable {
+            std::vector<uint8_t> data(length);
+            bool ok = false;
+            auto file = files_.get(path, false, false);
+            if (file) {
+                ssize_t n = pread_full(file->fd(), data.data(), length, offset);
+                if (n >= 0) {
+                    data.resize(static_cast<size_t>(n));
+                    ok = true;
+                }
+            }
+            if (!ok) {
+                data.clear();
+            }
+            boost::asio::post(io_context_, [handler = std::move(handler), ok, data = std::move(data)]() mutable {
+                handler(ok, std::move(data));
+            });
+        });
+    }
+
+    void async_write(const std::string& path, uint64_t offset, ChunkData data, size_t data_offset,
+                     size_t length, DiskWriteHandler handler) override {
+        boost::asio::post(pool_, [this, path, offset, data = std::move(data), data_offset, length,
+                                  handler = std::move(handler)]() mutable {
+            auto file = files_.get(path, true, false);
+            bool ok = file && pwrite_full(file->fd(), data->data() + data_offset, length, offset);
+            boost::asio::post(io_context_, [handler = std::move(handler), ok]() {
+                handler(ok);
+            });
+        });
+    }
+
+    const char* name() const override { return "thread-pool"; }
+    boost::asio::io_context& get_io_context() override { return io_context_; }
+
+private:
+    boost::asio::io_context& io_context_;
+    boost::asio::thread_pool pool_;
+    FileHandleCache files_;
+};
+
+#ifdef AURA_HAVE_IO_URING
+
+// Minimal io_uring wrapper over the raw system calls (no liburing needed)
+class IoUring {
+public:
+    ~IoUring() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd_ < 0) {
+            return false;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ring_ = single_mmap ? sq_ring_ :
+            mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<char*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        entries_ = params.sq_entries;
+        sqe_tail_ = *sq_tail_;
+        return true;
+    }
+
+    unsigned entries() const { return entries_; }
+
+    // Returns nullptr when the submission queue is full
+    io_uring_sqe* get_sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= entries_) {
+            return nullptr;
+        }
+        unsigned index = sqe_tail_ & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sq_array_[index] = index;
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    // Hands every prepared SQE to the kernel with a single system call
+    int submit(unsigned wait_for = 0) {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && wait_for == 0) {
+            return 0;
+        }
+        unsigned flags = wait_for ? IORING_ENTER_GETEVENTS : 0;
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, wait_for, flags, nullptr, 0));
+    }
+
+    // Copies out all available completions
+    void reap(std::vector<io_uring_cqe>& out) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            out.push_back(cqes_[head & *cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    int register_op(unsigned opcode, const void* arg, unsigned nr_args) {
+        return static_cast<int>(syscall(__NR_io_uring_register, fd_, opcode, arg, nr_args));
+    }
+
+    // Kernels before 5.6 set up a ring but lack the probe and the plain
+    // read/write opcodes, so a failed probe counts as unsupported
+    bool supports(std::initializer_list<unsigned> opcodes) {
+        const unsigned max_ops = 256;
+        std::vector<uint8_t> storage(sizeof(io_uring_probe) + max_ops * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (register_op(IORING_REGISTER_PROBE, probe, max_ops) < 0) {
+            return false;
+        }
+        for (unsigned opcode : opcodes) {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    int fd_ = -1;
+    unsigned entries_ = 0;
+    unsigned sqe_tail_ = 0;
+    void* sq_ring_ = MAP_FAILED;
+    void* cq_ring_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+};
+
+using AlignedBuffer = std::unique_ptr<uint8_t, decltype(&std::free)>;
+
+AlignedBuffer make_aligned_buffer(size_t size) {
+    void* ptr = nullptr;
+    if (posix_memalign(&ptr, DIRECT_IO_ALIGNMENT, size) != 0) {
+        ptr = nullptr;
+    }
+    return AlignedBuffer(static_cast<uint8_t*>(ptr), &std::free);
+}
+
+size_t align_up(size_t value) {
+    return (value + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+}
+
+// --- io_uring backend ---
+// Runs entirely on the io_context thread: requests are queued, submitted in
+// one batch per event loop turn, and completions arrive through an eventfd.
+class IoUringDiskBackend : public DiskBackend {
+public:
+    IoUringDiskBackend(boost::asio::io_context& io_context, const DiskOptions& options)
+        : io_context_(io_context),
+          options_(options),
+          event_stream_(io_context) {}
+
+    ~IoUringDiskBackend() override {
+        // The kernel may still write into request buffers, wait for it
+        std::vector<io_uring_cqe> cqes;
+        while (in_flight_ > 0) {
+            if (ring_.submit(1) < 0 && errno != EINTR) {
+                break;
+            }
+            cqes.clear();
+            ring_.reap(cqes);
+            for (const auto& cqe : cqes) {
+                delete reinterpret_cast<Request*>(cqe.user_data);
+                --in_flight_;
+            }
+        }
+        for (auto* buffer : fixed_buffers_) {
+            std::free(buffer);
+        }
+    }
+
+    bool init() {
+        if (!ring_.init(options_.queue_depth)) {
+            return false;
+        }
+        if (!ring_.supports({IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED})) {
+            std::cerr << "[Disk] io_uring lacks the read/write opcodes on this kernel." << std::endl;
+            return false;
+        }
+        int event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (event_fd < 0) {
+            return false;
+        }
+        event_stream_.assign(event_fd);
+        if (ring_.register_op(IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) {
+            return false;
+        }
+
+        if (options_.direct_io) {
+            register_buffers();
+        }
+        wait_for_completions();
+        return true;
+    }
+
+    void async_read(const std::string& path, uint64_t offset, size_t length, DiskReadHandler handler) override {
+        auto req = std::make_unique<Request>();
+        req->is_read = true;
+        req->offset = offset;
+        req->length = length;
+        req->read_handler = std::move(handler);
+
+        bool direct = options_.direct_io && offset % DIRECT_IO_ALIGNMENT == 0;
+        req->file = files_.get(path, false, direct);
+        if (!req->file && direct) {
+            direct = false;
+            req->file = files_.get(path, false, false);
+        }
+        if (!req->file) {
+            fail(std::move(req));
+            return;
+        }
+
+        if (direct) {
+            // O_DIRECT reads may only end on a block boundary, read past the
+            // requested length and trim on completion
+            req->io_length = align_up(length);
+            attach_aligned_buffer(*req);
+        } else {
+            req->io_length = length;
+            req->data.resize(length);
+            req->buffer = req->data.data();
+        }
+        enqueue(std::move(req));
+    }
+
+    void async_write(const std::string& path, uint64_t offset, ChunkData data, size_t data_offset,
+                     size_t length, DiskWriteHandler handler) override {
+        auto req = std::make_unique<Request>();
+        req->is_read = false;
+        req->offset = offset;
+        req->length = length;
+        req->io_length = length;
+        req->write_handler = std::move(handler);
+
+        // A partial tail chunk cannot be written with O_DIRECT
+        bool direct = options_.direct_io && offset % DIRECT_IO_ALIGNMENT == 0 &&
+                      length % DIRECT_IO_ALIGNMENT == 0;
+        req->file = files_.get(path, true, direct);
+        if (!req->file && direct) {
+            direct = false;
+            req->file = files_.get(path, true, false);
+        }
+        if (!req->file) {
+            fail(std::move(req));
+            return;
+        }
+
+        if (direct) {
+            attach_aligned_buffer(*req);
+            std::memcpy(req->buffer, data->data() + data_offset, length);
+        } else {
+            // The kernel only reads from the buffer of a write
+            req->buffer = const_cast<uint8_t*>(data->data() + data_offset);
+            req->source = std::move(data);
+        }
+        enqueue(std::move(req));
+    }
+
+    const char* name() const override { return "io_uring"; }
+    boost::asio::io_context& get_io_context() override { return io_context_; }
+
+private:
+    struct Request {
+        bool is_read = true;
+        std::shared_ptr<FileHandle> file; // Kept open until the request completes
+        uint64_t offset = 0;
+        size_t length = 0;          // Bytes the caller asked for
+        size_t io_length = 0;       // Bytes submitted to the kernel
+        uint8_t* buffer = nullptr;  // Kernel reads into / writes from here
+        int fixed_index = -1;       // Registered buffer slot, -1 if none
+        std::vector<uint8_t> data;  // Owned buffer for buffered reads
+        ChunkData source;           // Caller's buffer for buffered writes
+        AlignedBuffer aligned{nullptr, &std::free};
+        DiskReadHandler read_handler;
+        DiskWriteHandler write_handler;
+    };
+
+    void register_buffers() {
+        std::vector<iovec> iovecs;
+        for (unsigned i = 0; i < REGISTERED_BUFFER_COUNT; ++i) {
+            void* ptr = nullptr;
+            if (posix_memalign(&ptr, DIRECT_IO_ALIGNMENT, CHUNK_SIZE) != 0) {
+                break;
+            }
+            fixed_buffers_.push_back(static_cast<uint8_t*>(ptr));
+            iovecs.push_back({ptr, CHUNK_SIZE});
+        }
+        if (ring_.register_op(IORING_REGISTER_BUFFERS, iovecs.data(), static_cast<unsigned>(iovecs.size())) < 0) {
+            std::cerr << "[Disk] Could not register buffers, using plain O_DIRECT." << std::endl;
+            for (auto* buffer : fixed_buffers_) {
+                std::free(buffer);
+            }
+            fixed_buffers_.clear();
+            return;
+        }
+        for (unsigned i = 0; i < fixed_buffers_.size(); ++i) {
+            free_fixed_.push_back(static_cast<int>(i));
+        }
+    }
+
+    void attach_aligned_buffer(Request& req) {
+        if (req.io_length <= CHUNK_SIZE && !free_fixed_.empty()) {
+            req.fixed_index = free_fixed_.back();
+            free_fixed_.pop_back();
+            req.buffer = fixed_buffers_[req.fixed_index];
+            return;
+        }
+        req.aligned = make_aligned_buffer(req.io_length);
+        req.buffer = req.aligned.get();
+    }
+
+    void enqueue(std::unique_ptr<Request> req) {
+        backlog_.push_back(std::move(req));
+        if (!flush_scheduled_) {
+            // Everything queued during this event loop turn is submitted
+            // together with one io_uring_enter
+            flush_scheduled_ = true;
+            boost::asio::post(io_context_, [this]() { flush(); });
+        }
+    }
+
+    void flush() {
+        flush_scheduled_ = false;
+        while (!backlog_.empty() && in_flight_ < ring_.entries()) {
+            io_uring_sqe* sqe = ring_.get_sqe();
+            if (!sqe) {
+                break;
+            }
+            Request* req = backlog_.front().release();
+            backlog_.pop_front();
+
+            if (req->fixed_index >= 0) {
+                sqe->opcode = req->is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe->buf_index = static_cast<uint16_t>(req->fixed_index);
+            } else {
+                sqe->opcode = req->is_read ? IORING_OP_READ : IORING_OP_WRITE;
+            }
+            sqe->fd = req->file->fd();
+            sqe->off = req->offset;
+            sqe->addr = reinterpret_cast<uint64_t>(req->buffer);
+            sqe->len = static_cast<uint32_t>(req->io_length);
+            sqe->user_data = reinterpret_cast<uint64_t>(req);
+            ++in_flight_;
+        }
+        if (ring_.submit() < 0) {
+            std::cerr << "[Disk] io_uring_enter failed: " << std::strerror(errno) << std::endl;
+        }
+    }
+
+    void wait_for_completions() {
+        event_stream_.async_read_some(boost::asio::buffer(&event_count_, sizeof(event_count_)),
+            [this](const boost::system::error_code& ec, std::size_t /*length*/) {
+                if (ec == boost::asio::error::operation_aborted) {
+                    return;
+                }
+                std::vector<io_uring_cqe> cqes;
+                ring_.reap(cqes);
+                for (const auto& cqe : cqes) {
+                    --in_flight_;
+                    complete(std::unique_ptr<Request>(reinterpret_cast<Request*>(cqe.user_data)), cqe.res);
+                }
+                if (!backlog_.empty()) {
+                    flush();
+                }
+                wait_for_completions();
+            });
+    }
+
+    void complete(std::unique_ptr<Request> req, int res) {
+        if (req->fixed_index >= 0) {
+            free_fixed_.push_back(req->fixed_index);
+        }
+
+        if (!req->is_read) {
+            req->write_handler(res >= 0 && static_cast<size_t>(res) == req->length);
+            return;
+        }
+        if (res < 0) {
+            req->read_handler(false, {});
+            return;
+        }
+        size_t got = std::min(static_cast<size_t>(res), req->length);
+        if (req->buffer == req->data.data()) {
+            req->data.resize(got);
+            req->read_handler(true, std::move(req->data));
+        } else {
+            req->read_handler(true, std::vector<uint8_t>(req->buffer, req->buffer + got));
+        }
+    }
+
+    void fail(std::unique_ptr<Request> req) {
+        std::shared_ptr<Request> failed(std::move(req));
+        boost::asio::post(io_context_, [failed]() {
+            if (failed->is_read) {
+                failed->read_handler(false, {});
+            } else {
+                failed->write_handler(false);
+            }
+        });
+    }
+
+    boost::asio::io_context& io_context_;
+    DiskOptions options_;
+    IoUring ring_;
+    boost::asio::posix::stream_descriptor event_stream_;
+    uint64_t event_count_ = 0;
+    std::deque<std::unique_ptr<Request>> backlog_;
+    unsigned in_flight_ = 0;
+    bool flush_scheduled_ = false;
+    FileHandleCache files_;
+    std::vector<uint8_t*> fixed_buffers_;
+    std::vector<int> free_fixed_;
+};
+
+#endif // AURA_HAVE_IO_URING
+
+} // namespace
+
+std::unique_ptr<DiskBackend> make_disk_backend(boost::asio::io_context& io_context, const DiskOptions& options) {
+#ifdef AURA_HAVE_IO_URING
+    if (options.kind != DiskOptions::Kind::THREAD_POOL) {
+        auto backend = std::make_unique<IoUringDiskBackend>(io_context, options);
+        if (backend->init()) {
+            return backend;
+        }
+        std::cerr << "[Disk] io_uring is not available, using the thread pool backend." << std::endl;
+    }
+#else
+    if (options.kind == DiskOptions::Kind::IO_URING) {
+        std::cerr << "[Disk] Built without io_uring support, using the thread pool backend." << std::endl;
+    }
+#endif
+    return std::make_unique<ThreadPoolDiskBackend>(io_context, options.threads);
+}
+
+} // namespace aura
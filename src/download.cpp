@@ -0,0 +1,682 @@
+#include "download.hpp"
+#include "node.hpp"
+#include "session.hpp"
+#include "verifier.hpp"
+#include "aura/dht_utils.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace aura {
+
+namespace {
+
+// Most chunks a Metadata frame can describe: each chunk hash costs a tag, a
+// length byte and 20 bytes. Bounds peer bitfields before our metadata is in.
+const size_t MAX_METADATA_CHUNKS = MAX_METADATA_FRAME_SIZE / 22;
+
+} // namespace
+
+Download::Download(Node& node, const std::string& file_hash, const std::string& output_path)
+    : node_(node),
+      file_hash_(file_hash)
+{
+    file_info_.file_path = output_path;
+    file_info_.file_hash.assign(file_hash.begin(), file_hash.end());
+    file_info_.file_size = 0;
+    stats_.started_at = std::chrono::steady_clock::now();
+    span_ = trace::Span::begin("download", "download");
+}
+
+Download::PeerState* Download::find_peer(const std::shared_ptr<Session>& session) {
+    auto it = std::find_if(peers_.begin(), peers_.end(), [&](const PeerState& p) {
+        return p.session == session;
+    });
+    return it == peers_.end() ? nullptr : &*it;
+}
+
+std::vector<Download::InFlight>::iterator Download::find_in_flight(PeerState& peer, uint32_t chunk_index) {
+    return std::find_if(peer.in_flight.begin(), peer.in_flight.end(), [chunk_index](const InFlight& r) {
+        return r.chunk_index == chunk_index;
+    });
+}
+
+bool Download::peer_has(const PeerState& peer, uint32_t chunk_index) {
+    if (!peer.has_bitfield) {
+        return true;
+    }
+    size_t byte = chunk_index / 8;
+    return byte < peer.bits.size() && (peer.bits[byte] & (0x80 >> (chunk_index % 8)));
+}
+
+bool Download::wants_from(const PeerState& peer) const {
+    if (!has_metadata_) {
+        return true;
+    }
+    // Chunks are requested lowest index first, so the missing ones are usually at the end
+    for (size_t i = have_.size(); i-- > 0;) {
+        if (!have_[i] && peer_has(peer, static_cast<uint32_t>(i))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Download::update_interest(PeerState& peer) {
+    bool interested = wants_from(peer);
+    if (interested == peer.interested) {
+        return;
+    }
+    peer.interested = interested;
+    MessageWrapper msg;
+    msg.mutable_interested()->set_interested(interested);
+    peer.session->do_write(msg);
+}
+
+size_t Download::chunk_limit() const {
+    return has_metadata_ ? have_.size() : MAX_METADATA_CHUNKS;
+}
+
+void Download::fill_bitfield(Bitfield* bitfield) const {
+    std::string bits((stored_.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < stored_.size(); ++i) {
+        if (stored_[i]) {
+            bits[i / 8] |= static_cast<char>(0x80 >> (i % 8));
+        }
+    }
+    bitfield->set_file_hash(file_hash_);
+    bitfield->set_bits(bits);
+}
+
+size_t Download::pipeline_depth(const PeerState& peer) const {
+    double rate = peer.session->get_stats().download_rate;
+    if (rate <= 0) {
+        return PIPELINE_DEPTH;
+    }
+    auto depth = static_cast<size_t>(rate * PIPELINE_TARGET_SECONDS / CHUNK_SIZE) + 1;
+    return std::max(MIN_PIPELINE_DEPTH, std::min(depth, MAX_PIPELINE_DEPTH));
+}
+
+std::vector<Download::PeerState*> Download::ranked_peers() {
+    std::vector<PeerState*> ranked;
+    for (auto& peer : peers_) {
+        ranked.push_back(&peer);
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const PeerState* a, const PeerState* b) {
+        if (a->session->is_local() != b->session->is_local()) {
+            return a->session->is_local();
+        }
+        const auto& sa = a->session->get_stats();
+        const auto& sb = b->session->get_stats();
+        if (sa.download_rate != sb.download_rate) {
+            return sa.download_rate > sb.download_rate;
+        }
+        return sa.rtt_ms < sb.rtt_ms;
+    });
+    return ranked;
+}
+
+void Download::set_stream_handler(StreamHandler handler, size_t window) {
+    stream_handler_ = std::move(handler);
+    stream_window_ = std::max<size_t>(window, 1);
+}
+
+void Download::add_spare_providers(std::vector<PeerInfo> providers, bool preferred) {
+    auto known = [this](const PeerInfo& p) {
+        return providers_.count(p.peer_id()) || std::any_of(spare_providers_.begin(), spare_providers_.end(),
+            [&](const PeerInfo& spare) { return spare.peer_id() == p.peer_id(); });
+    };
+    providers.erase(std::remove_if(providers.begin(), providers.end(), known), providers.end());
+    spare_providers_.insert(preferred ? spare_providers_.begin() : spare_providers_.end(),
+                            providers.begin(), providers.end());
+}
+
+bool Download::add_provider(const std::string& peer_id) {
+    return providers_.insert(peer_id).second;
+}
+
+void Download::add_connection(const Session* session, const std::string& provider_id) {
+    connections_[session] = provider_id;
+}
+
+void Download::replenish_providers() {
+    if (finished_ || !started_ || !peers_.empty() || !connections_.empty()) {
+        return;
+    }
+    // A spare can fail to connect synchronously, or be one we already tried
+    while (connections_.empty() && !spare_providers_.empty()) {
+        PeerInfo provider = spare_providers_.front();
+        spare_providers_.erase(spare_providers_.begin());
+        std::cout << "[Download] No peers left, trying " << provider.address() << ":" << provider.port() << std::endl;
+        node_.connect_provider(shared_from_this(), provider);
+    }
+    if (connections_.empty()) {
+        fail("no providers left");
+    }
+}
+
+void Download::add_peer(std::shared_ptr<Session> session) {
+    if (finished_ || find_peer(session)) {
+        return;
+    }
+    std::cout << "[Download] Peer " << dht::to_hex(session->get_remote_peer_id()) << " joined download of "
+              << dht::to_hex(file_hash_) << std::endl;
+    peers_.push_back({session, {}, Clock::now()});
+    // Tells the peer what we can serve; its answer says what it holds
+    session->send_bitfield(file_hash_);
+    update_interest(peers_.back());
+
+    if (!has_metadata_) {
+        if (!metadata_peer_) {
+            request_metadata();
+        }
+        return;
+    }
+    schedule(peers_.back());
+}
+
+void Download::remove_peer(std::shared_ptr<Session> session) {
+    if (finished_) {
+        return;
+    }
+    auto self = shared_from_this();
+    // Also reached by sessions that never got to join, e.g. a failed connect.
+    // The provider may be connected again once it is rediscovered.
+    auto connection = connections_.find(session.get());
+    if (connection != connections_.end()) {
+        providers_.erase(connection->second);
+        connections_.erase(connection);
+    }
+    auto it = std::find_if(peers_.begin(), peers_.end(), [&](const PeerState& p) {
+        return p.session == session;
+    });
+    if (it != peers_.end()) {
+        PeerState peer = std::move(*it);
+        peers_.erase(it);
+        auto in_flight = peer.in_flight;
+        for (const auto& request : in_flight) {
+            release_request(peer, request.chunk_index, "peer left");
+        }
+        std::cout << "[Download] Peer left, " << peers_.size() << " peer(s) remaining." << std::endl;
+
+        if (metadata_peer_ == session.get()) {
+            metadata_peer_ = nullptr;
+            request_metadata();
+        }
+        schedule_all();
+    }
+    replenish_providers();
+}
+
+void Download::request_metadata() {
+    if (peers_.empty()) {
+        return;
+    }
+    auto& peer = peers_.front();
+    metadata_peer_ = peer.session.get();
+
+    MessageWrapper msg;
+    msg.mutable_request_metadata()->set_file_hash(file_hash_);
+    peer.session->do_write(msg);
+}
+
+void Download::handle_metadata(std::shared_ptr<Session> session, const Metadata& metadata) {
+    auto self = shared_from_this();
+    if (finished_ || has_metadata_ || metadata.file_hash() != file_hash_) {
+        return;
+    }
+
+    if (!read_metadata(metadata, &file_info_)) {
+        std::cerr << "[Download] Peer sent inconsistent metadata, dropping it." << std::endl;
+        session->stop();
+        return;
+    }
+    // A directory share is rebuilt below the output path
+    if (!file_info_.files.empty() && !prepare_directory(file_info_)) {
+        std::cerr << "[Download] Could not create the directory tree for " << file_info_.file_path << std::endl;
+        fail("cannot create the directory tree");
+        return;
+    }
+    size_t expected_chunks = file_info_.chunk_hashes.size();
+    has_metadata_ = true;
+    metadata_peer_ = nullptr;
+
+    have_.assign(expected_chunks, false);
+    verifying_.assign(expected_chunks, false);
+    stored_.assign(expected_chunks, false);
+    request_count_.assign(expected_chunks, 0);
+    chunks_remaining_ = expected_chunks;
+    unrequested_ = expected_chunks;
+
+    std::cout << "[Download] Got metadata: " << file_info_.file_size << " bytes in "
+              << expected_chunks << " chunk(s)";
+    if (!file_info_.files.empty()) {
+        std::cout << ", " << file_info_.files.size() << " file(s)";
+    }
+    std::cout << "." << std::endl;
+
+    if (chunks_remaining_ == 0) {
+        finish();
+        return;
+    }
+    for (auto& peer : peers_) {
+        update_interest(peer);
+    }
+    schedule_all();
+}
+
+bool Download::in_endgame() const {
+    return has_metadata_ && unrequested_ == 0 && chunks_remaining_ <= ENDGAME_THRESHOLD;
+}
+
+void Download::schedule_all() {
+    // Fastest peers pick first, so the chunks left over go to slow ones
+    for (auto* peer : ranked_peers()) {
+        schedule(*peer);
+    }
+}
+
+void Download::schedule(PeerState& peer) {
+    if (finished_ || !has_metadata_ || peer.choked) {
+        return;
+    }
+    size_t depth = pipeline_depth(peer);
+
+    // Normal phase: hand out chunks nobody has been asked for yet, lowest
+    // index first. A stream only looks stream_window_ chunks past its consumer.
+    size_t end = have_.size();
+    if (streaming()) {
+        end = std::min<size_t>(end, stream_consumed_ + stream_window_);
+    }
+    for (uint32_t i = 0; i < end && unrequested_ > 0 && peer.in_flight.size() < depth; ++i) {
+        if (is_missing(i) && request_count_[i] == 0 && peer_has(peer, i)) {
+            send_request(peer, i);
+        }
+    }
+
+    if (!in_endgame()) {
+        return;
+    }
+
+    // Endgame: ask this peer for outstanding chunks other peers are still
+    // working on; whichever verified copy arrives first wins.
+    for (uint32_t i = 0; i < have_.size() && peer.in_flight.size() < depth; ++i) {
+        if (!is_missing(i) || request_count_[i] >= ENDGAME_MAX_REQUESTS || !peer_has(peer, i) ||
+            find_in_flight(peer, i) != peer.in_flight.end()) {
+            continue;
+        }
+        if (request_count_[i] > 0) {
+            ++stats_.endgame_requests;
+        }
+        send_request(peer, i);
+    }
+}
+
+void Download::send_request(PeerState& peer, uint32_t chunk_index) {
+    if (request_count_[chunk_index] == 0) {
+        --unrequested_;
+    }
+    ++request_count_[chunk_index];
+    peer.in_flight.push_back({chunk_index, Clock::now(), trace::Span::begin("chunk", "request", chunk_index)});
+
+    MessageWrapper msg;
+    auto* req = msg.mutable_request_chunk();
+    req->set_file_hash(file_hash_);
+    req->set_chunk_index(chunk_index);
+    peer.session->do_write(msg);
+}
+
+void Download::release_request(PeerState& peer, uint32_t chunk_index, const char* outcome) {
+    auto it = find_in_flight(peer, chunk_index);
+    if (it == peer.in_flight.end()) {
+        return;
+    }
+    it->span.end(outcome);
+    peer.in_flight.erase(it);
+    if (--request_count_[chunk_index] == 0 && is_missing(chunk_index)) {
+        ++unrequested_;
+    }
+}
+
+void Download::handle_chunk(std::shared_ptr<Session> session, SendChunk& chunk) {
+    auto self = shared_from_this();
+    PeerState* peer = find_peer(session);
+    if (finished_ || !has_metadata_ || !peer || chunk.file_hash() != file_hash_ ||
+        chunk.chunk_index() >= have_.size()) {
+        return;
+    }
+
+    uint32_t index = chunk.chunk_index();
+    stats_.wire_bytes += chunk.data().size();
+
+    if (!is_missing(index)) {
+        // Lost the endgame race for this chunk, or it was already on the
+        // wire when our CancelChunk reached the peer
+        release_request(*peer, index, "duplicate");
+        stats_.duplicate_bytes += chunk.compression() == COMPRESSION_NONE ? chunk.data().size() : chunk.raw_size();
+        ++stats_.duplicate_chunks;
+        schedule(*peer);
+        return;
+    }
+    auto request = find_in_flight(*peer, index);
+    if (request == peer->in_flight.end()) {
+        return; // Not requested from this peer
+    }
+    session->record_rtt(Clock::now() - request->requested_at);
+    request->span.end();
+
+    // Hashing happens on the verifier pool; the chunk is neither missing nor
+    // held until the result comes back
+    verifying_[index] = true;
+    release_request(*peer, index, nullptr);
+
+    VerifyJob job;
+    job.payload.swap(*chunk.mutable_data()); // No copy: the parsed string's buffer moves
+    job.compression = chunk.compression();
+    job.raw_size = chunk.raw_size();
+    job.expected_hash = file_info_.chunk_hashes[index];
+    node_.get_chunk_verifier().submit(std::move(job),
+        [self, session, index, span = trace::Span::begin("chunk", "verify", index)](
+            bool ok, std::vector<uint8_t> data) mutable {
+            span.end();
+            self->on_chunk_verified(session, index, ok, std::move(data));
+        });
+
+    schedule(*peer);
+}
+
+void Download::on_chunk_verified(std::shared_ptr<Session> session, uint32_t index, bool ok,
+                                 std::vector<uint8_t> data) {
+    auto self = shared_from_this();
+    if (finished_) {
+        return;
+    }
+    verifying_[index] = false;
+    PeerState* peer = find_peer(session);
+
+    if (!ok) {
+        std::cerr << "[Download] Chunk " << index << " failed verification, re-requesting." << std::endl;
+        ++stats_.failed_chunks;
+        if (request_count_[index] == 0) {
+            ++unrequested_;
+        }
+        if (peer && ++peer->corrupt_chunks >= MAX_CORRUPT_CHUNKS) {
+            drop_peer(*peer, "corrupt data"); // Reschedules through remove_peer
+        } else {
+            schedule_all();
+        }
+        return;
+    }
+
+    if (stats_.bytes_received == 0) {
+        auto elapsed = std::chrono::duration<double>(Clock::now() - stats_.started_at).count();
+        std::cout << "[Download] First chunk verified after " << elapsed << "s" << std::endl;
+    }
+    have_[index] = true;
+    --chunks_remaining_;
+    stats_.bytes_received += data.size();
+    // The disk write and the stream consumer share one buffer
+    auto chunk = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    if (streaming() && index >= stream_next_) {
+        stream_buffer_.emplace(index, chunk);
+    }
+
+    ++pending_writes_;
+    node_.get_file_sharer().async_save_chunk(file_info_, index, std::move(chunk),
+        [self, index, span = trace::Span::begin("disk", "write chunk", index)](bool ok) mutable {
+            span.end();
+            self->on_chunk_written(index, ok);
+        });
+
+    // Withdraw the duplicate requests still pending at other peers
+    for (auto& other : peers_) {
+        if (find_in_flight(other, index) == other.in_flight.end()) {
+            continue;
+        }
+        release_request(other, index, "cancelled");
+        MessageWrapper msg;
+        auto* cancel = msg.mutable_cancel_chunk();
+        cancel->set_file_hash(file_hash_);
+        cancel->set_chunk_index(index);
+        other.session->do_write(msg);
+        ++stats_.cancels_sent;
+    }
+    // Peers that only had chunks we now hold are no longer interesting
+    for (auto& other : peers_) {
+        if (other.interested && peer_has(other, index)) {
+            update_interest(other);
+        }
+    }
+
+    deliver_stream();
+    if (finished_ || chunks_remaining_ == 0) {
+        return; // Finishes once the last write lands
+    }
+
+    if (in_endgame()) {
+        schedule_all();
+    } else if (peer) {
+        schedule(*peer);
+    }
+}
+
+void Download::handle_choke(std::shared_ptr<Session> session, bool choked) {
+    auto self = shared_from_this();
+    PeerState* peer = find_peer(session);
+    if (finished_ || !peer || peer->choked == choked) {
+        return;
+    }
+    peer->choked = choked;
+
+    if (choked) {
+        // A choking peer discards our queued requests, hand them to others
+        std::cout << "[Download] Choked by " << dht::to_hex(session->get_remote_peer_id()) << std::endl;
+        auto in_flight = peer->in_flight;
+        for (const auto& request : in_flight) {
+            release_request(*peer, request.chunk_index, "choked");
+        }
+        schedule_all();
+    } else {
+        std::cout << "[Download] Unchoked by " << dht::to_hex(session->get_remote_peer_id()) << std::endl;
+        schedule(*peer);
+    }
+}
+
+void Download::handle_bitfield(std::shared_ptr<Session> session, const Bitfield& bitfield) {
+    auto self = shared_from_this();
+    PeerState* peer = find_peer(session);
+    if (finished_ || !peer || bitfield.file_hash() != file_hash_) {
+        return;
+    }
+    // Bits past the last chunk carry nothing; do not store them
+    size_t length = std::min(bitfield.bits().size(), (chunk_limit() + 7) / 8);
+    peer->has_bitfield = true;
+    peer->bits.assign(bitfield.bits().begin(), bitfield.bits().begin() + length);
+    update_interest(*peer);
+    schedule(*peer);
+}
+
+void Download::handle_have(std::shared_ptr<Session> session, uint32_t chunk_index) {
+    auto self = shared_from_this();
+    PeerState* peer = find_peer(session);
+    if (finished_ || !peer || !peer->has_bitfield || chunk_index >= chunk_limit()) {
+        return;
+    }
+    size_t byte = chunk_index / 8;
+    if (byte >= peer->bits.size()) {
+        peer->bits.resize(byte + 1, 0);
+    }
+    peer->bits[byte] |= static_cast<uint8_t>(0x80 >> (chunk_index % 8));
+    if (has_metadata_ && chunk_index < have_.size() && !have_[chunk_index]) {
+        update_interest(*peer);
+    }
+    if (has_metadata_ && chunk_index < have_.size() && is_missing(chunk_index)) {
+        schedule(*peer);
+    }
+}
+
+void Download::drop_peer(PeerState& peer, const char* reason) {
+    std::cout << "[Download] Dropping peer " << dht::to_hex(peer.session->get_remote_peer_id())
+              << " (" << reason << ")" << std::endl;
+    auto session = peer.session;
+    session->stop(); // Calls remove_peer, which re-queues its chunks
+
+    if (!spare_providers_.empty()) {
+        PeerInfo provider = spare_providers_.front();
+        spare_providers_.erase(spare_providers_.begin());
+        std::cout << "[Download] Replacing it with " << provider.address() << ":" << provider.port() << std::endl;
+        node_.connect_provider(shared_from_this(), provider);
+    }
+}
+
+void Download::on_tick() {
+    auto self = shared_from_this();
+    if (finished_ || !has_metadata_) {
+        return;
+    }
+    auto now = Clock::now();
+
+    // Stalled peers: a request has been sitting unanswered for too long
+    for (auto& peer : peers_) {
+        bool stalled = std::any_of(peer.in_flight.begin(), peer.in_flight.end(), [&](const InFlight& r) {
+            return now - r.requested_at > REQUEST_TIMEOUT;
+        });
+        if (stalled) {
+            for (auto& request : peer.in_flight) {
+                request.span.end("timeout");
+            }
+            drop_peer(peer, "stalled");
+            return; // peers_ changed, continue on the next tick
+        }
+    }
+
+    // Slow peers: keep them only while nobody better is around
+    size_t active = std::count_if(peers_.begin(), peers_.end(), [](const PeerState& p) { return !p.choked; });
+    if (peers_.size() < 2 || active < 2) {
+        return;
+    }
+    auto by_rate = [](const PeerState& a, const PeerState& b) {
+        return a.session->get_stats().download_rate < b.session->get_stats().download_rate;
+    };
+    double best_rate = std::max_element(peers_.begin(), peers_.end(), by_rate)->session->get_stats().download_rate;
+    PeerState* slowest = &*std::min_element(peers_.begin(), peers_.end(), by_rate);
+    if (!slowest->choked && now - slowest->joined_at > SLOW_PEER_GRACE &&
+        slowest->session->get_stats().download_rate < best_rate * SLOW_PEER_RATIO) {
+        drop_peer(*slowest, "slow");
+    }
+}
+
+void Download::on_chunk_written(uint32_t chunk_index, bool ok) {
+    --pending_writes_;
+    if (finished_) {
+        return;
+    }
+
+    if (!ok) {
+        std::cerr << "[Download] Failed to write chunk " << chunk_index << ", re-requesting." << std::endl;
+        have_[chunk_index] = false;
+        ++chunks_remaining_;
+        if (request_count_[chunk_index] == 0) {
+            ++unrequested_;
+        }
+        stats_.bytes_received -= std::min<uint64_t>(CHUNK_SIZE,
+            file_info_.file_size - static_cast<uint64_t>(chunk_index) * CHUNK_SIZE);
+        for (auto& peer : peers_) {
+            update_interest(peer);
+        }
+        schedule_all();
+        return;
+    }
+
+    stored_[chunk_index] = true;
+    ++stored_count_;
+    // Announces us as a provider after the first chunk, and Have to our peers
+    node_.on_chunk_stored(file_hash_, chunk_index, stored_count_ == 1);
+
+    maybe_finish();
+}
+
+void Download::deliver_stream() {
+    auto self = shared_from_this();
+    while (streaming() && !stream_buffer_.empty() && stream_buffer_.begin()->first == stream_next_) {
+        ChunkData chunk = std::move(stream_buffer_.begin()->second);
+        stream_buffer_.erase(stream_buffer_.begin());
+        if (stream_next_++ == 0) {
+            auto elapsed = std::chrono::duration<double>(Clock::now() - stats_.started_at).count();
+            std::cout << "[Download] Streaming first bytes after " << elapsed << "s" << std::endl;
+        }
+        stream_handler_(std::move(chunk), [self]() { self->on_stream_consumed(); });
+    }
+}
+
+void Download::on_stream_consumed() {
+    ++stream_consumed_;
+    if (finished_) {
+        return;
+    }
+    // The window moved: there may be new chunks to request
+    schedule_all();
+    maybe_finish();
+}
+
+void Download::maybe_finish() {
+    if (finished_ || chunks_remaining_ != 0 || pending_writes_ != 0) {
+        return;
+    }
+    if (streaming() && stream_consumed_ < have_.size()) {
+        return;
+    }
+    finish();
+}
+
+void Download::fail(const char* reason) {
+    finished_ = true;
+    span_.end();
+    std::cerr << "[Download] Giving up on " << dht::to_hex(file_hash_) << ": " << reason << std::endl;
+
+    if (streaming()) {
+        auto handler = std::move(stream_handler_);
+        stream_handler_ = nullptr;
+        handler(nullptr, nullptr); // Closes the stream short
+    }
+
+    auto peers = std::move(peers_);
+    peers_.clear();
+    for (auto& peer : peers) {
+        peer.session->stop();
+    }
+    node_.on_download_finished(file_hash_);
+}
+
+void Download::finish() {
+    finished_ = true;
+    span_.end();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - stats_.started_at).count();
+
+    std::cout << "[Download] Completed " << dht::to_hex(file_hash_) << " -> " << file_info_.file_path
+              << " in " << elapsed << "s" << std::endl;
+    std::cout << "[Download] Stats: received=" << stats_.bytes_received
+              << " wire_bytes=" << stats_.wire_bytes
+              << " duplicate_bytes=" << stats_.duplicate_bytes
+              << " duplicate_chunks=" << stats_.duplicate_chunks
+              << " failed_chunks=" << stats_.failed_chunks
+              << " endgame_requests=" << stats_.endgame_requests
+              << " cancels_sent=" << stats_.cancels_sent << std::endl;
+
+    if (streaming()) {
+        auto handler = std::move(stream_handler_);
+        stream_handler_ = nullptr;
+        handler(nullptr, nullptr); // End of stream
+    }
+
+    // We hold the whole file now and can serve it to others
+    node_.available_files_[file_hash_] = file_info_;
+
+    auto peers = std::move(peers_);
+    peers_.clear();
+    for (auto& peer : peers) {
+        peer.session->stop();
+    }
+    node_.on_download_finished(file_hash_);
+}
+
+} // namespace aura
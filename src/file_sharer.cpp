@@ -1,9 +1,17 @@
 #include "file_sharer.hpp"
+#include "disk_io.hpp"
 #include "node.hpp"
 #include "aura.pb.h"
 #include <fstream>
 #include <openssl/evp.h>
 #include <memory>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include <iostream>
+
+namespace aura {
 
 // Helper for managing EVP_MD_CTX context
 using EVP_MD_CTX_ptr = std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)>;
@@ -24,57 +32,197 @@ std::vector<uint8_t> calculate_sha1(const char* data, size_t len) {
     return hash;
 }
 
+bool is_safe_path(const std::string& path) {
+    if (path.empty() || path.front() == '/' || path.find('\0') != std::string::npos) {
+        return false;
+    }
+    size_t begin = 0;
+    while (begin <= path.size()) {
+        size_t end = path.find('/', begin);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::string component = path.substr(begin, end - begin);
+        if (component.empty() || component == "." || component == "..") {
+            return false;
+        }
+        begin = end + 1;
+    }
+    return true;
+}
 
-#include <iostream>
+std::vector<ChunkSegment> chunk_segments(const FileInfo& file_info, uint32_t chunk_index) {
+    uint64_t begin = static_cast<uint64_t>(chunk_index) * CHUNK_SIZE;
+    uint64_t end = std::min<uint64_t>(begin + CHUNK_SIZE, file_info.file_size);
+    std::vector<ChunkSegment> segments;
+    if (file_info.files.empty()) {
+        segments.push_back({file_info.file_path, begin, 0, end > begin ? static_cast<size_t>(end - begin) : 0});
+        return segments;
+    }
 
-namespace aura {
+    // First file that ends past the start of the chunk
+    auto it = std::upper_bound(file_info.files.begin(), file_info.files.end(), begin,
+        [](uint64_t offset, const FileEntry& entry) { return offset < entry.offset + entry.size; });
+    for (; it != file_info.files.end() && it->offset < end; ++it) {
+        if (it->size == 0) {
+            continue;
+        }
+        uint64_t from = std::max(begin, it->offset);
+        uint64_t to = std::min(end, it->offset + it->size);
+        segments.push_back({file_info.file_path + "/" + it->path, from - it->offset,
+                            static_cast<size_t>(from - begin), static_cast<size_t>(to - from)});
+    }
+    return segments;
+}
 
-bool FileSharer::share_file(const std::string& file_path, Node& node) {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file.is_open()) {
+std::vector<uint8_t> manifest_root_hash(const FileInfo& file_info) {
+    EVP_MD_CTX_ptr mdctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+    EVP_DigestInit_ex(mdctx.get(), EVP_get_digestbyname("SHA1"), NULL);
+    for (const auto& entry : file_info.files) {
+        uint8_t size[9] = {0};
+        for (int i = 0; i < 8; ++i) {
+            size[1 + i] = static_cast<uint8_t>(entry.size >> (56 - 8 * i));
+        }
+        EVP_DigestUpdate(mdctx.get(), entry.path.data(), entry.path.size());
+        EVP_DigestUpdate(mdctx.get(), size, sizeof(size)); // Zero separator, then the size
+    }
+    for (const auto& hash : file_info.chunk_hashes) {
+        EVP_DigestUpdate(mdctx.get(), hash.data(), hash.size());
+    }
+
+    std::vector<uint8_t> hash(EVP_MAX_MD_SIZE);
+    unsigned int hash_len;
+    EVP_DigestFinal_ex(mdctx.get(), hash.data(), &hash_len);
+    hash.resize(hash_len);
+    return hash;
+}
+
+void fill_metadata(const FileInfo& file_info, Metadata* metadata) {
+    metadata->set_file_hash(file_info.file_hash.data(), file_info.file_hash.size());
+    metadata->set_file_size(file_info.file_size);
+    metadata->set_chunk_size(CHUNK_SIZE);
+    for (const auto& hash : file_info.chunk_hashes) {
+        metadata->add_chunk_hashes(hash.data(), hash.size());
+    }
+    for (const auto& entry : file_info.files) {
+        auto* file = metadata->add_files();
+        file->set_path(entry.path);
+        file->set_size(entry.size);
+    }
+}
+
+bool read_metadata(const Metadata& metadata, FileInfo* file_info) {
+    uint64_t expected_chunks = (metadata.file_size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (metadata.chunk_size() != CHUNK_SIZE ||
+        static_cast<uint64_t>(metadata.chunk_hashes_size()) != expected_chunks) {
         return false;
     }
 
+    FileInfo parsed;
+    parsed.file_path = file_info->file_path;
+    parsed.file_hash.assign(metadata.file_hash().begin(), metadata.file_hash().end());
+    parsed.file_size = metadata.file_size();
+    for (const auto& hash : metadata.chunk_hashes()) {
+        parsed.chunk_hashes.emplace_back(hash.begin(), hash.end());
+    }
+
+    uint64_t offset = 0;
+    for (const auto& entry : metadata.files()) {
+        if (!is_safe_path(entry.path()) || entry.size() > parsed.file_size - offset ||
+            (!parsed.files.empty() && entry.path() <= parsed.files.back().path)) {
+            return false;
+        }
+        parsed.files.push_back({entry.path(), entry.size(), offset});
+        offset += entry.size();
+    }
+    if (!parsed.files.empty() && (offset != parsed.file_size || manifest_root_hash(parsed) != parsed.file_hash)) {
+        return false;
+    }
+
+    *file_info = std::move(parsed);
+    return true;
+}
+
+bool prepare_directory(const FileInfo& file_info) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(file_info.file_path, ec);
+    fs::path last_parent;
+    for (const auto& entry : file_info.files) {
+        fs::path path = fs::path(file_info.file_path) / entry.path;
+        if (!ec && path.parent_path() != last_parent) {
+            last_parent = path.parent_path();
+            fs::create_directories(last_parent, ec);
+        }
+        if (ec) {
+            std::cerr << "[FileSharer] Could not create " << path.parent_path() << ": " << ec.message() << std::endl;
+            return false;
+        }
+        // Files with data are created by the first chunk written to them
+        if (entry.size == 0 && !std::ofstream(path, std::ios::binary | std::ios::app)) {
+            std::cerr << "[FileSharer] Could not create " << path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+FileSharer::FileSharer() = default;
+FileSharer::~FileSharer() = default;
+
+void FileSharer::set_disk_backend(std::unique_ptr<DiskBackend> backend) {
+    disk_backend_ = std::move(backend);
+    std::cout << "[FileSharer] Using " << disk_backend_->name() << " disk backend" << std::endl;
+}
+
+bool FileSharer::share_file(const std::string& file_path, Node& node) {
     FileInfo file_info;
     file_info.file_path = file_path;
 
-    file.seekg(0, std::ios::end);
-    file_info.file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
+    std::error_code ec;
+    if (std::filesystem::is_directory(file_path, ec)) {
+        if (!hash_directory(file_path, file_info)) {
+            return false;
+        }
+    } else {
+        std::ifstream file(file_path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
 
-    // Calculate the hash of the entire file
-    EVP_MD_CTX_ptr mdctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
-    const EVP_MD* md = EVP_get_digestbyname("SHA1");
-    EVP_DigestInit_ex(mdctx.get(), md, NULL);
+        file.seekg(0, std::ios::end);
+        file_info.file_size = file.tellg();
+        file.seekg(0, std::ios::beg);
 
-    char buffer[CHUNK_SIZE];
-    while (file) {
-        file.read(buffer, CHUNK_SIZE);
-        std::streamsize count = file.gcount();
-        if (count > 0) {
-            // Hash of the chunk
-            file_info.chunk_hashes.push_back(calculate_sha1(buffer, count));
-            // Update the total hash
-            EVP_DigestUpdate(mdctx.get(), buffer, count);
+        // Calculate the hash of the entire file
+        EVP_MD_CTX_ptr mdctx(EVP_MD_CTX_new(), &EVP_MD_CTX_free);
+        const EVP_MD* md = EVP_get_digestbyname("SHA1");
+        EVP_DigestInit_ex(mdctx.get(), md, NULL);
+
+        char buffer[CHUNK_SIZE];
+        while (file) {
+            file.read(buffer, CHUNK_SIZE);
+            std::streamsize count = file.gcount();
+            if (count > 0) {
+                // Hash of the chunk
+                file_info.chunk_hashes.push_back(calculate_sha1(buffer, count));
+                // Update the total hash
+                EVP_DigestUpdate(mdctx.get(), buffer, count);
+            }
         }
-    }
 
-    file_info.file_hash.resize(EVP_MAX_MD_SIZE);
-    unsigned int hash_len;
-    EVP_DigestFinal_ex(mdctx.get(), file_info.file_hash.data(), &hash_len);
-    file_info.file_hash.resize(hash_len);
+        file_info.file_hash.resize(EVP_MAX_MD_SIZE);
+        unsigned int hash_len;
+        EVP_DigestFinal_ex(mdctx.get(), file_info.file_hash.data(), &hash_len);
+        file_info.file_hash.resize(hash_len);
+    }
 
     std::string file_hash_str(file_info.file_hash.begin(), file_info.file_hash.end());
     node.available_files_[file_hash_str] = file_info;
 
     // Save metadata to a .aura file
     aura::Metadata metadata;
-    metadata.set_file_hash(file_info.file_hash.data(), file_info.file_hash.size());
-    metadata.set_file_size(file_info.file_size);
-    metadata.set_chunk_size(CHUNK_SIZE);
-    for (const auto& hash : file_info.chunk_hashes) {
-        metadata.add_chunk_hashes(hash.data(), hash.size());
-    }
+    fill_metadata(file_info, &metadata);
 
     std::string metadata_path = file_path + ".aura";
     std::ofstream metadata_file(metadata_path, std::ios::binary);
@@ -86,52 +234,234 @@ bool FileSharer::share_file(const std::string& file_path, Node& node) {
     return true;
 }
 
+bool FileSharer::hash_directory(const std::string& root, FileInfo& file_info) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        // Symlinks are left out, so a share never reaches outside its root
+        if (it->is_symlink(ec) || !it->is_regular_file(ec)) {
+            continue;
+        }
+        uint64_t size = it->file_size(ec);
+        if (ec) {
+            break;
+        }
+        file_info.files.push_back({it->path().lexically_relative(root).generic_string(), size, 0});
+    }
+    if (ec) {
+        std::cerr << "[FileSharer] Could not list " << root << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    std::sort(file_info.files.begin(), file_info.files.end(),
+              [](const FileEntry& a, const FileEntry& b) { return a.path < b.path; });
+    uint64_t offset = 0;
+    for (auto& entry : file_info.files) {
+        entry.offset = offset;
+        offset += entry.size;
+    }
+    file_info.file_size = offset;
+
+    // Chunks run across file boundaries: a partly filled buffer carries over
+    std::vector<char> buffer(CHUNK_SIZE);
+    size_t filled = 0;
+    for (const auto& entry : file_info.files) {
+        std::ifstream file(root + "/" + entry.path, std::ios::binary);
+        uint64_t remaining = entry.size;
+        while (remaining > 0 && file) {
+            size_t count = static_cast<size_t>(std::min<uint64_t>(CHUNK_SIZE - filled, remaining));
+            file.read(buffer.data() + filled, count);
+            filled += file.gcount();
+            remaining -= file.gcount();
+            if (filled == CHUNK_SIZE) {
+                file_info.chunk_hashes.push_back(calculate_sha1(buffer.data(), filled));
+                filled = 0;
+            }
+        }
+        if (remaining > 0) {
+            std::cerr << "[FileSharer] " << entry.path << " changed while hashing." << std::endl;
+            return false;
+        }
+    }
+    if (filled > 0) {
+        file_info.chunk_hashes.push_back(calculate_sha1(buffer.data(), filled));
+    }
+
+    file_info.file_hash = manifest_root_hash(file_info);
+    std::cout << "[FileSharer] Packed " << file_info.files.size() << " file(s), " << file_info.file_size
+              << " bytes into " << file_info.chunk_hashes.size() << " chunk(s)" << std::endl;
+    return true;
+}
+
 FileInfo FileSharer::load_metadata(const std::string& metadata_path) {
     FileInfo file_info;
     aura::Metadata metadata;
 
     std::ifstream metadata_file(metadata_path, std::ios::binary);
-    if (!metadata.ParseFromIstream(&metadata_file)) {
+    if (!metadata.ParseFromIstream(&metadata_file) || !read_metadata(metadata, &file_info)) {
         return {}; // Return an empty object if reading failed
     }
 
-    file_info.file_hash.assign(metadata.file_hash().begin(), metadata.file_hash().end());
-    file_info.file_size = metadata.file_size();
-    for (const auto& hash : metadata.chunk_hashes()) {
-        file_info.chunk_hashes.emplace_back(hash.begin(), hash.end());
-    }
-
     return file_info;
 }
 
 std::vector<uint8_t> FileSharer::get_chunk(const FileInfo& file_info, uint32_t chunk_index) {
-    std::ifstream file(file_info.file_path, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "[FileSharer] ERROR: Could not open file for reading: " << file_info.file_path << std::endl;
-        return {};
-    }
-
-    file.seekg(chunk_index * CHUNK_SIZE);
     std::vector<uint8_t> data(CHUNK_SIZE);
-    file.read(reinterpret_cast<char*>(data.data()), CHUNK_SIZE);
-    data.resize(file.gcount());
+    size_t size = 0;
+    for (const auto& segment : chunk_segments(file_info, chunk_index)) {
+        std::ifstream file(segment.path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "[FileSharer] ERROR: Could not open file for reading: " << segment.path << std::endl;
+            return {};
+        }
+        file.seekg(segment.file_offset);
+        file.read(reinterpret_cast<char*>(data.data() + segment.chunk_offset), segment.length);
+        size = segment.chunk_offset + file.gcount();
+        if (static_cast<size_t>(file.gcount()) < segment.length) {
+            break;
+        }
+    }
+    data.resize(size);
 
     std::cout << "[FileSharer] Read chunk " << chunk_index << " from " << file_info.file_path << ", size: " << data.size() << std::endl;
     return data;
 }
 
 void FileSharer::save_chunk(const FileInfo& file_info, uint32_t chunk_index, const std::vector<uint8_t>& data) {
-    std::fstream file(file_info.file_path, std::ios::binary | std::ios::in | std::ios::out);
-    if (!file.is_open()) {
-        std::cout << "[FileSharer] File not found, creating new one: " << file_info.file_path << std::endl;
-        std::ofstream new_file(file_info.file_path, std::ios::binary);
-        new_file.close();
-        file.open(file_info.file_path, std::ios::binary | std::ios::in | std::ios::out);
-    }
+    for (const auto& segment : chunk_segments(file_info, chunk_index)) {
+        std::fstream file(segment.path, std::ios::binary | std::ios::in | std::ios::out);
+        if (!file.is_open()) {
+            std::cout << "[FileSharer] File not found, creating new one: " << segment.path << std::endl;
+            std::ofstream new_file(segment.path, std::ios::binary);
+            new_file.close();
+            file.open(segment.path, std::ios::binary | std::ios::in | std::ios::out);
+        }
 
-    file.seekp(chunk_index * CHUNK_SIZE);
-    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        file.seekp(segment.file_offset);
+        file.write(reinterpret_cast<const char*>(data.data() + segment.chunk_offset),
+                   std::min(segment.length, data.size() - std::min(data.size(), segment.chunk_offset)));
+    }
     std::cout << "[FileSharer] Wrote chunk " << chunk_index << " to " << file_info.file_path << ", size: " << data.size() << std::endl;
 }
 
+void FileSharer::async_get_chunk(const FileInfo& file_info, uint32_t chunk_index, ChunkReadHandler handler) {
+    std::string key = ChunkCache::make_key(file_info.file_hash, chunk_index);
+    if (auto data = chunk_cache_.get(key)) {
+        if (!disk_backend_) {
+            handler(true, std::move(data));
+        } else {
+            // Like a disk read, never from inside the caller
+            boost::asio::post(disk_backend_->get_io_context(), [handler = std::move(handler), data]() mutable {
+                handler(true, std::move(data));
+            });
+        }
+        return;
+    }
+
+    auto& waiting = pending_reads_[key];
+    waiting.push_back(std::move(handler));
+    if (waiting.size() > 1) {
+        return; // A read for this chunk is already in flight
+    }
+
+    if (!disk_backend_) {
+        auto data = get_chunk(file_info, chunk_index);
+        complete_read(key, !data.empty(), std::move(data));
+        return;
+    }
+
+    auto segments = chunk_segments(file_info, chunk_index);
+    if (segments.size() == 1) {
+        const auto& segment = segments.front();
+        disk_backend_->async_read(segment.path, segment.file_offset, segment.length,
+            [this, key](bool ok, std::vector<uint8_t> data) {
+                complete_read(key, ok, std::move(data));
+            });
+        return;
+    }
+
+    // A chunk of a directory share: read every file it spans, then assemble
+    struct SegmentedRead {
+        std::vector<uint8_t> data;
+        size_t pending;
+        bool ok = true;
+    };
+    if (segments.empty()) {
+        complete_read(key, false, {});
+        return;
+    }
+    auto read = std::make_shared<SegmentedRead>();
+    read->pending = segments.size();
+    read->data.resize(segments.back().chunk_offset + segments.back().length);
+    for (const auto& segment : segments) {
+        disk_backend_->async_read(segment.path, segment.file_offset, segment.length,
+            [this, key, read, offset = segment.chunk_offset, length = segment.length](
+                bool ok, std::vector<uint8_t> data) {
+                if (ok && data.size() == length) {
+                    std::memcpy(read->data.data() + offset, data.data(), length);
+                } else {
+                    read->ok = false;
+                }
+                if (--read->pending == 0) {
+                    complete_read(key, read->ok, std::move(read->data));
+                }
+            });
+    }
+}
+
+void FileSharer::complete_read(const std::string& key, bool ok, std::vector<uint8_t> data) {
+    auto it = pending_reads_.find(key);
+    auto handlers = std::move(it->second);
+    pending_reads_.erase(it);
+
+    ChunkData chunk;
+    if (ok) {
+        chunk = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+        chunk_cache_.put(key, chunk);
+    }
+    for (auto& handler : handlers) {
+        handler(ok, chunk);
+    }
+}
+
+void FileSharer::async_save_chunk(const FileInfo& file_info, uint32_t chunk_index, ChunkData data,
+                                  DiskWriteHandler handler) {
+    if (!disk_backend_) {
+        save_chunk(file_info, chunk_index, *data);
+        handler(true);
+        return;
+    }
+
+    auto segments = chunk_segments(file_info, chunk_index);
+    if (segments.size() == 1) {
+        size_t length = data->size();
+        disk_backend_->async_write(segments.front().path, segments.front().file_offset, std::move(data), 0,
+                                   length, std::move(handler));
+        return;
+    }
+
+    // One write per file the chunk spans; the handler runs after the last one
+    struct SegmentedWrite {
+        DiskWriteHandler handler;
+        size_t pending;
+        bool ok = true;
+    };
+    auto write = std::make_shared<SegmentedWrite>();
+    write->handler = std::move(handler);
+    write->pending = segments.size();
+    if (segments.empty() || segments.back().chunk_offset + segments.back().length != data->size()) {
+        write->handler(false);
+        return;
+    }
+    for (const auto& segment : segments) {
+        disk_backend_->async_write(segment.path, segment.file_offset, data, segment.chunk_offset, segment.length,
+            [write](bool ok) {
+                write->ok = write->ok && ok;
+                if (--write->pending == 0) {
+                    write->handler(write->ok);
+                }
+            });
+    }
+}
+
 }
@@ -0,0 +1,188 @@
+#include "local_discovery.hpp"
+#include "aura/dht_utils.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace aura {
+
+namespace {
+const size_t LSD_RECV_BUFFER_SIZE = 2048;
+}
+
+LocalDiscovery::LocalDiscovery(boost::asio::io_context& io_context, const std::string& self_id,
+                               unsigned short tcp_port, const std::string& interface_address)
+    : io_context_(io_context),
+      socket_(io_context),
+      group_endpoint_(boost::asio::ip::make_address_v4(LSD_MULTICAST_GROUP), LSD_PORT),
+      interface_address_(boost::asio::ip::make_address_v4(interface_address)),
+      self_id_(self_id),
+      tcp_port_(tcp_port),
+      recv_buffer_(LSD_RECV_BUFFER_SIZE) {}
+
+bool LocalDiscovery::start() {
+    namespace multicast = boost::asio::ip::multicast;
+    boost::system::error_code ec;
+    socket_.open(boost::asio::ip::udp::v4(), ec);
+    // Every node on the host binds the same port
+    if (!ec) socket_.set_option(boost::asio::ip::udp::socket::reuse_address(true), ec);
+    if (!ec) socket_.bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v4::any(), LSD_PORT), ec);
+    if (!ec) socket_.set_option(multicast::join_group(group_endpoint_.address().to_v4(), interface_address_), ec);
+    if (!ec) socket_.set_option(multicast::hops(1), ec);
+    if (!ec) socket_.set_option(multicast::enable_loopback(true), ec);
+    if (!ec && !interface_address_.is_unspecified()) {
+        socket_.set_option(multicast::outbound_interface(interface_address_), ec);
+    }
+    if (ec) {
+        std::cerr << "[LSD] Local discovery disabled: " << ec.message() << std::endl;
+        socket_.close(ec);
+        return false;
+    }
+    std::cout << "[LSD] Listening on " << group_endpoint_ << std::endl;
+    do_receive();
+    return true;
+}
+
+void LocalDiscovery::announce(const std::vector<std::string>& file_hashes) {
+    if (!socket_.is_open()) {
+        return;
+    }
+    expire_providers();
+    for (size_t begin = 0; begin < file_hashes.size(); begin += LSD_HASHES_PER_ANNOUNCE) {
+        LocalDiscoveryMessage msg;
+        auto* announce = msg.mutable_announce();
+        announce->set_peer_id(self_id_);
+        announce->set_port(tcp_port_);
+        size_t end = std::min(file_hashes.size(), begin + LSD_HASHES_PER_ANNOUNCE);
+        for (size_t i = begin; i < end; ++i) {
+            announce->add_file_hashes(file_hashes[i]);
+        }
+        send(msg);
+    }
+}
+
+void LocalDiscovery::query(const std::string& file_hash) {
+    if (!socket_.is_open()) {
+        return;
+    }
+    LocalDiscoveryMessage msg;
+    auto* query = msg.mutable_query();
+    query->set_peer_id(self_id_);
+    query->set_file_hash(file_hash);
+    send(msg);
+}
+
+std::vector<PeerInfo> LocalDiscovery::get_providers(const std::string& file_hash) {
+    std::vector<PeerInfo> result;
+    auto it = providers_.find(file_hash);
+    if (it == providers_.end()) {
+        return result;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto& providers = it->second;
+    providers.erase(std::remove_if(providers.begin(), providers.end(), [&](const LocalProvider& p) {
+        return p.expires_at <= now;
+    }), providers.end());
+    std::sort(providers.begin(), providers.end(), [](const LocalProvider& a, const LocalProvider& b) {
+        return a.expires_at > b.expires_at;
+    });
+    for (const auto& provider : providers) {
+        result.push_back(provider.info);
+    }
+    if (providers.empty()) {
+        providers_.erase(it);
+    }
+    return result;
+}
+
+void LocalDiscovery::expire_providers() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = providers_.begin(); it != providers_.end();) {
+        auto& providers = it->second;
+        providers.erase(std::remove_if(providers.begin(), providers.end(), [&](const LocalProvider& p) {
+            return p.expires_at <= now;
+        }), providers.end());
+        it = providers.empty() ? providers_.erase(it) : std::next(it);
+    }
+}
+
+bool LocalDiscovery::is_local_provider(const std::string& file_hash, const std::string& peer_id) const {
+    auto it = providers_.find(file_hash);
+    if (it == providers_.end()) {
+        return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    return std::any_of(it->second.begin(), it->second.end(), [&](const LocalProvider& p) {
+        return p.info.peer_id() == peer_id && p.expires_at > now;
+    });
+}
+
+void LocalDiscovery::do_receive() {
+    socket_.async_receive_from(boost::asio::buffer(recv_buffer_), recv_endpoint_,
+        [this](boost::system::error_code ec, std::size_t length) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec && length > 0) {
+                LocalDiscoveryMessage msg;
+                if (msg.ParseFromArray(recv_buffer_.data(), static_cast<int>(length))) {
+                    handle_message(msg, recv_endpoint_);
+                }
+            }
+            do_receive();
+        });
+}
+
+void LocalDiscovery::handle_message(const LocalDiscoveryMessage& msg, const boost::asio::ip::udp::endpoint& sender) {
+    if (msg.has_query()) {
+        const auto& query = msg.query();
+        if (query.peer_id() != self_id_ && file_filter_ && file_filter_(query.file_hash())) {
+            announce({query.file_hash()});
+        }
+        return;
+    }
+    if (!msg.has_announce() || msg.announce().peer_id() == self_id_ || msg.announce().port() == 0 ||
+        msg.announce().port() > 65535) {
+        return;
+    }
+
+    const auto& announce = msg.announce();
+    PeerInfo info;
+    info.set_address(sender.address().to_string());
+    info.set_port(announce.port());
+    info.set_peer_id(announce.peer_id());
+    auto expires_at = std::chrono::steady_clock::now() + LSD_PROVIDER_TTL;
+
+    for (const auto& file_hash : announce.file_hashes()) {
+        if (wanted_filter_ && !wanted_filter_(file_hash)) {
+            continue;
+        }
+        auto& providers = providers_[file_hash];
+        auto it = std::find_if(providers.begin(), providers.end(), [&](const LocalProvider& p) {
+            return p.info.peer_id() == info.peer_id();
+        });
+        if (it == providers.end()) {
+            std::cout << "[LSD] " << info.address() << ":" << info.port() << " provides "
+                      << dht::to_hex(file_hash) << std::endl;
+            providers.push_back({info, expires_at});
+        } else {
+            *it = {info, expires_at};
+        }
+        if (provider_handler_) {
+            provider_handler_(file_hash, info);
+        }
+    }
+}
+
+void LocalDiscovery::send(const LocalDiscoveryMessage& msg) {
+    PooledBuffer datagram = BufferPool::instance().acquire(msg.ByteSizeLong());
+    msg.SerializeWithCachedSizesToArray(datagram.data());
+    auto buffer = boost::asio::buffer(datagram.data(), datagram.size());
+    socket_.async_send_to(buffer, group_endpoint_,
+        [datagram = std::move(datagram)](boost::system::error_code ec, std::size_t /*bytes_sent*/) {
+            if (ec) {
+                std::cerr << "[LSD] Send failed: " << ec.message() << std::endl;
+            }
+        });
+}
+
+} // namespace aura
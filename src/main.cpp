@@ -1,10 +1,16 @@
 #include <iostream>
 #include <boost/asio.hpp>
+#include <csignal>
+#include <functional>
 #include <thread>
 #include <string>
 #include <vector>
+#include <unistd.h>
 
 #include "node.hpp"
+#include "disk_io.hpp"
+#include "stream_sink.hpp"
+#include "trace.hpp"
 
 // Prototype for the function to connect to a bootstrap node
 void bootstrap_node(aura::Node& node, const std::string& host_port_str);
@@ -18,6 +24,23 @@ int main(int argc, char* argv[]) {
         std::string connect_peer; // New argument for direct TCP connection
         std::string file_to_share;
         std::string hash_to_download;
+        int compress_level = 0;
+        aura::DiskOptions disk_options;
+        bool custom_disk_options = false;
+        size_t upload_slots = aura::DEFAULT_UPLOAD_SLOTS;
+        size_t max_sessions = aura::DEFAULT_MAX_SESSIONS;
+        int stats_interval = 0;
+        size_t cache_bytes = aura::DEFAULT_CHUNK_CACHE_BYTES;
+        size_t verify_threads = aura::DEFAULT_VERIFY_THREADS;
+        bool exit_on_complete = false;
+        std::string stream_target;
+        std::string trace_path;
+        size_t stream_window = aura::DEFAULT_STREAM_WINDOW;
+        bool local_discovery = true;
+        std::string lsd_interface = "0.0.0.0";
+        bool datagram = false;
+        double impair_loss = 0;
+        int impair_delay_ms = 0;
 
         std::vector<std::string> args(argv + 1, argv + argc);
         for (size_t i = 0; i < args.size(); ++i) {
@@ -31,16 +54,92 @@ int main(int argc, char* argv[]) {
                 file_to_share = args[++i];
             } else if (args[i] == "--download" && i + 1 < args.size()) {
                 hash_to_download = args[++i];
+            } else if (args[i] == "--compress-level" && i + 1 < args.size()) {
+                compress_level = std::stoi(args[++i]);
+            } else if (args[i] == "--disk-backend" && i + 1 < args.size()) {
+                const std::string& kind = args[++i];
+                if (kind == "uring") {
+                    disk_options.kind = aura::DiskOptions::Kind::IO_URING;
+                } else if (kind == "threads") {
+                    disk_options.kind = aura::DiskOptions::Kind::THREAD_POOL;
+                }
+                custom_disk_options = true;
+            } else if (args[i] == "--direct-io") {
+                disk_options.direct_io = true;
+                custom_disk_options = true;
+            } else if (args[i] == "--upload-slots" && i + 1 < args.size()) {
+                upload_slots = std::stoul(args[++i]);
+            } else if (args[i] == "--max-sessions" && i + 1 < args.size()) {
+                max_sessions = std::stoul(args[++i]);
+            } else if (args[i] == "--stats-interval" && i + 1 < args.size()) {
+                stats_interval = std::stoi(args[++i]);
+            } else if (args[i] == "--verify-threads" && i + 1 < args.size()) {
+                verify_threads = std::stoul(args[++i]);
+            } else if (args[i] == "--stream" && i + 1 < args.size()) {
+                stream_target = args[++i];
+            } else if (args[i] == "--stream-window" && i + 1 < args.size()) {
+                stream_window = std::stoul(args[++i]);
+            } else if (args[i] == "--trace" && i + 1 < args.size()) {
+                trace_path = args[++i];
+            } else if (args[i] == "--no-lsd") {
+                local_discovery = false;
+            } else if (args[i] == "--lsd-interface" && i + 1 < args.size()) {
+                lsd_interface = args[++i];
+            } else if (args[i] == "--datagram") {
+                datagram = true;
+            } else if (args[i] == "--datagram-impair" && i + 1 < args.size()) {
+                // "<loss percent>,<delay ms>", e.g. "2,30"
+                const std::string& spec = args[++i];
+                size_t comma = spec.find(',');
+                impair_loss = std::stod(spec.substr(0, comma)) / 100;
+                impair_delay_ms = comma == std::string::npos ? 0 : std::stoi(spec.substr(comma + 1));
+            } else if (args[i] == "--exit-on-complete") {
+                exit_on_complete = true;
+            } else if (args[i] == "--cache-mb" && i + 1 < args.size()) {
+                cache_bytes = std::stoul(args[++i]) * 1024 * 1024;
             } else if (args[i] == "--help") {
-                std::cout << "Usage: " << argv[0] << " [--port <port>] [--bootstrap <host:port>] [--connect <host:port>] [--share <file>] [--download <hash>]" << std::endl;
+                std::cout << "Usage: " << argv[0] << " [--port <port>] [--bootstrap <host:port>] [--connect <host:port>] [--share <file|dir>] [--download <hash>]"
+                          << " [--compress-level <0-9>] [--disk-backend <auto|uring|threads>] [--direct-io]"
+                          << " [--upload-slots <n>] [--max-sessions <n>] [--stats-interval <seconds>] [--cache-mb <n, 0 disables>]"
+                          << " [--verify-threads <n>] [--exit-on-complete]"
+                          << " [--stream <file|fifo|-> [--stream-window <chunks>]]"
+                          << " [--trace <file.json>] (SIGUSR2 toggles tracing)"
+                          << " [--no-lsd] [--lsd-interface <ipv4>]"
+                          << " [--datagram [--datagram-impair <loss%>,<delay_ms>]]" << std::endl;
                 return 0;
             }
         }
 
         // --- Node Initialization ---
         boost::asio::io_context io_context;
+        // Opened first: with "-", stdout is handed to the stream and logs move to stderr
+        std::shared_ptr<aura::StreamSink> stream_sink;
+        if (!stream_target.empty() && !hash_to_download.empty()) {
+            stream_sink = aura::StreamSink::open(io_context, stream_target);
+            if (!stream_sink) {
+                return 1;
+            }
+        }
         aura::Node node(io_context, port, port);
+        node.get_chunk_compressor().set_level(compress_level);
+        node.set_upload_slots(upload_slots);
+        node.set_max_sessions(max_sessions);
+        node.set_stats_interval(std::chrono::seconds(stats_interval));
+        node.set_exit_on_complete(exit_on_complete);
+        node.get_file_sharer().get_chunk_cache().set_budget(cache_bytes);
+        if (verify_threads != aura::DEFAULT_VERIFY_THREADS) {
+            node.set_verify_threads(verify_threads);
+        }
+        if (custom_disk_options) {
+            node.get_file_sharer().set_disk_backend(aura::make_disk_backend(io_context, disk_options));
+        }
         node.listen(port);
+        if (local_discovery) {
+            node.enable_local_discovery(lsd_interface);
+        }
+        if (datagram && node.enable_datagram_transport() && (impair_loss > 0 || impair_delay_ms > 0)) {
+            node.get_datagram_transport()->set_impairment(impair_loss, std::chrono::milliseconds(impair_delay_ms));
+        }
 
         std::cout << "Aura node started." << std::endl;
         std::cout << "Listening on TCP/UDP port " << port << std::endl;
@@ -87,15 +186,40 @@ int main(int argc, char* argv[]) {
         if (!hash_to_download.empty()) {
             // A small delay before searching to allow time to get a response from the bootstrap node
             auto timer = std::make_shared<boost::asio::steady_timer>(io_context, std::chrono::seconds(3));
-            timer->async_wait([&node, hash_to_download, timer](const boost::system::error_code& ec) {
+            timer->async_wait([&node, hash_to_download, stream_sink, stream_window, timer](const boost::system::error_code& ec) {
                 if (!ec) {
-                    node.download_file(hash_to_download);
+                    node.download_file(hash_to_download, stream_sink ? stream_sink->handler() : nullptr,
+                                       stream_window);
                 }
             });
         }
 
+        // --- Tracing ---
+        // SIGUSR2 starts or stops recording; SIGINT/SIGTERM stop the node so
+        // an open trace still gets written.
+        if (trace_path.empty()) {
+            trace_path = "aura-trace-" + std::to_string(::getpid()) + ".json";
+        } else {
+            aura::trace::start(trace_path);
+        }
+        boost::asio::signal_set signals(io_context, SIGINT, SIGTERM, SIGUSR2);
+        std::function<void(const boost::system::error_code&, int)> on_signal =
+            [&](const boost::system::error_code& ec, int signal) {
+                if (ec) {
+                    return;
+                }
+                if (signal == SIGUSR2) {
+                    aura::trace::toggle(trace_path);
+                    signals.async_wait(on_signal);
+                } else {
+                    io_context.stop();
+                }
+            };
+        signals.async_wait(on_signal);
+
         // --- Start the main event processing loop ---
         io_context.run();
+        aura::trace::stop();
 
     } catch (const std::exception& e) {
         std::cerr << "Critical error: " << e.what() << std::endl;
@@ -1,10 +1,15 @@
 #include "node.hpp"
 #include "session.hpp"
+#include "disk_io.hpp"
+#include "buffer_pool.hpp"
+#include "trace.hpp"
 #include "aura/dht_utils.hpp" // Для to_hex, from_hex
 #include <iostream>
 #include <random>
 #include <thread>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
 #include <iomanip>
 
 namespace aura {
@@ -29,10 +34,39 @@ void Node::generate_id() {
     std::cout << "Generated 160-bit Peer ID: " << dht::to_hex(peer_id_) << std::endl;
 }
 
+void Node::generate_certificate() {
+    // Peers authenticate each other by peer_id, not by certificate, so an
+    // ephemeral self-signed certificate is enough to run the TLS handshake.
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_EC_gen("P-256"), &EVP_PKEY_free);
+    std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), &X509_free);
+    if (!key || !cert) {
+        throw std::runtime_error("Failed to allocate TLS key or certificate");
+    }
+
+    ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert.get()), 60L * 60 * 24 * 365);
+    X509_set_pubkey(cert.get(), key.get());
+
+    std::string common_name = dht::to_hex(peer_id_);
+    X509_NAME* name = X509_get_subject_name(cert.get());
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>(common_name.c_str()), -1, -1, 0);
+    X509_set_issuer_name(cert.get(), name);
+
+    if (!X509_sign(cert.get(), key.get(), EVP_sha256()) ||
+        SSL_CTX_use_certificate(ssl_context_.native_handle(), cert.get()) != 1 ||
+        SSL_CTX_use_PrivateKey(ssl_context_.native_handle(), key.get()) != 1) {
+        throw std::runtime_error("Failed to set up TLS certificate");
+    }
+}
+
 Node::Node(boost::asio::io_context& io_context, short tcp_port, short udp_port)
     : io_context_(io_context),
       ssl_context_(ssl::context::tlsv12),
-      self_tcp_port_(tcp_port) // Save our own TCP port
+      self_tcp_port_(tcp_port), // Save our own TCP port
+      tick_timer_(io_context),
+      chunk_compressor_(io_context)
 {
     generate_id();
 
@@ -41,9 +75,248 @@ Node::Node(boost::asio::io_context& io_context, short tcp_port, short udp_port)
         ssl::context::no_sslv2 | ssl::context::no_sslv3 |
         ssl::context::single_dh_use);
     ssl_context_.set_verify_mode(ssl::verify_none);
+    generate_certificate();
+
+    file_sharer_.set_disk_backend(make_disk_backend(io_context, DiskOptions{}));
+    chunk_verifier_ = std::make_unique<ChunkVerifier>(io_context);
 
     dht_node_ = std::make_unique<DhtNode>(io_context, udp_port, peer_id_);
     dht_node_->start();
+
+    start_tick_timer();
+}
+
+void Node::set_verify_threads(size_t threads) {
+    chunk_verifier_ = std::make_unique<ChunkVerifier>(io_context_, threads);
+}
+
+void Node::start_tick_timer() {
+    last_tick_ = std::chrono::steady_clock::now();
+    tick_timer_.expires_after(std::chrono::seconds(1));
+    tick_timer_.async_wait([this](const boost::system::error_code& ec) {
+        if (!ec) {
+            on_tick();
+            start_tick_timer();
+        }
+    });
+}
+
+void Node::on_tick() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_tick_).count();
+    ++ticks_;
+
+    for (const auto& session : sessions_) {
+        session->update_rates(elapsed);
+    }
+
+    // Copy: a tick may finish a download or replace its peers
+    std::vector<std::shared_ptr<Download>> downloads;
+    for (const auto& entry : downloads_) {
+        downloads.push_back(entry.second);
+    }
+    for (const auto& download : downloads) {
+        download->on_tick();
+    }
+
+    if (ticks_ % RECHOKE_INTERVAL.count() == 0) {
+        rechoke();
+    }
+    if (stats_interval_.count() > 0 && ticks_ % stats_interval_.count() == 0) {
+        log_stats();
+    }
+    if (local_discovery_ && ticks_ % LSD_ANNOUNCE_INTERVAL.count() == 0) {
+        local_discovery_->announce(get_served_files());
+    }
+}
+
+bool Node::enable_local_discovery(const std::string& interface_address) {
+    boost::system::error_code ec;
+    boost::asio::ip::make_address_v4(interface_address, ec);
+    if (ec) {
+        std::cerr << "[LSD] Invalid interface address: " << interface_address << std::endl;
+        return false;
+    }
+    auto discovery = std::make_unique<LocalDiscovery>(io_context_, peer_id_, self_tcp_port_, interface_address);
+    if (!discovery->start()) {
+        return false;
+    }
+    discovery->set_file_filter([this](const std::string& file_hash) {
+        return available_files_.count(file_hash) ||
+               (downloads_.count(file_hash) && downloads_.at(file_hash)->get_stored_count() > 0);
+    });
+    discovery->set_wanted_filter([this](const std::string& file_hash) {
+        return downloads_.count(file_hash) > 0;
+    });
+    discovery->set_provider_handler([this](const std::string& file_hash, const PeerInfo& provider) {
+        on_local_provider(file_hash, provider);
+    });
+    local_discovery_ = std::move(discovery);
+    return true;
+}
+
+bool Node::enable_datagram_transport() {
+    auto transport = std::make_unique<DatagramTransport>(io_context_);
+    if (!transport->start()) {
+        return false;
+    }
+    datagram_transport_ = std::move(transport);
+    return true;
+}
+
+std::vector<std::string> Node::get_served_files() const {
+    std::vector<std::string> files;
+    for (const auto& entry : available_files_) {
+        files.push_back(entry.first);
+    }
+    for (const auto& entry : downloads_) {
+        if (entry.second->get_stored_count() > 0) {
+            files.push_back(entry.first);
+        }
+    }
+    return files;
+}
+
+void Node::on_local_provider(const std::string& file_hash, const PeerInfo& provider) {
+    auto it = downloads_.find(file_hash);
+    if (it == downloads_.end() || !it->second->is_started()) {
+        return;
+    }
+    auto download = it->second;
+    if (download->get_provider_count() < MAX_DOWNLOAD_PEERS) {
+        connect_provider(download, provider);
+    } else {
+        download->add_spare_providers({provider}, true);
+    }
+}
+
+void Node::rechoke() {
+    // Reciprocation first: peers that send us the most data get the regular
+    // slots, with our upload rate to them as tie-breaker (pure seeds). We
+    // receive on the sessions we opened and upload on the ones the peer
+    // opened, so received rates are summed per peer id.
+    std::unordered_map<std::string, double> received;
+    std::vector<std::shared_ptr<Session>> interested;
+    for (const auto& session : sessions_) {
+        received[session->get_remote_peer_id()] += session->get_stats().download_rate;
+        if (session->is_interested()) {
+            interested.push_back(session);
+        }
+    }
+    std::sort(interested.begin(), interested.end(), [&](const std::shared_ptr<Session>& a, const std::shared_ptr<Session>& b) {
+        double ra = received[a->get_remote_peer_id()];
+        double rb = received[b->get_remote_peer_id()];
+        if (ra != rb) {
+            return ra > rb;
+        }
+        return a->get_stats().upload_rate > b->get_stats().upload_rate;
+    });
+
+    size_t regular_slots = upload_slots_ > 1 ? upload_slots_ - 1 : upload_slots_;
+    std::unordered_set<std::shared_ptr<Session>> unchoke;
+    for (size_t i = 0; i < interested.size() && i < regular_slots; ++i) {
+        unchoke.insert(interested[i]);
+    }
+
+    // The optimistic slot gives a newcomer the chance to prove itself
+    auto optimistic = optimistic_unchoke_.lock();
+    bool rotate = ++rechoke_round_ % OPTIMISTIC_UNCHOKE_ROUNDS == 0;
+    if (!optimistic || rotate || unchoke.count(optimistic) || !optimistic->is_interested()) {
+        std::vector<std::shared_ptr<Session>> choices;
+        for (const auto& session : interested) {
+            if (!unchoke.count(session) && session != optimistic) {
+                choices.push_back(session);
+            }
+        }
+        if (choices.empty() && optimistic && !unchoke.count(optimistic) && optimistic->is_interested()) {
+            choices.push_back(optimistic);
+        }
+        static std::mt19937 rng(std::random_device{}());
+        optimistic = choices.empty() ? nullptr : choices[std::uniform_int_distribution<size_t>(0, choices.size() - 1)(rng)];
+        optimistic_unchoke_ = optimistic;
+    }
+    if (optimistic && unchoke.size() < upload_slots_) {
+        unchoke.insert(optimistic);
+    }
+
+    // Sessions that lost interest give up their slot too
+    for (const auto& session : sessions_) {
+        session->set_choked(!unchoke.count(session));
+    }
+}
+
+void Node::on_peer_interested(std::shared_ptr<Session> session) {
+    size_t busy = 0;
+    for (const auto& other : sessions_) {
+        if (other != session && other->is_interested() && !other->is_choked()) {
+            ++busy;
+        }
+    }
+    // Free slots are handed out immediately, the rest wait for the next rechoke
+    session->set_choked(busy >= upload_slots_);
+}
+
+void Node::log_stats() {
+    std::cout << "[Stats] " << sessions_.size() << " session(s), " << downloads_.size() << " download(s), "
+              << sessions_rejected_ << " inbound rejected" << std::endl;
+    for (const auto& session : sessions_) {
+        const auto& stats = session->get_stats();
+        std::cout << "[Stats] peer " << dht::to_hex(session->get_remote_peer_id()).substr(0, 8)
+                  << " up=" << static_cast<uint64_t>(stats.upload_rate / 1024) << "KB/s"
+                  << " down=" << static_cast<uint64_t>(stats.download_rate / 1024) << "KB/s"
+                  << " rtt=" << static_cast<uint64_t>(stats.rtt_ms) << "ms"
+                  << " sent=" << stats.bytes_uploaded
+                  << " received=" << stats.bytes_downloaded
+                  << (session->is_choked() ? " choked" : "")
+                  << (session->is_interested() ? " interested" : "");
+        const DatagramChannel* channel = session->get_datagram_channel();
+        if (channel && channel->is_established()) {
+            auto udp = channel->get_stats();
+            std::cout << " udp cwnd=" << udp.cwnd / 1024 << "KB"
+                      << " inflight=" << udp.bytes_in_flight / 1024 << "KB"
+                      << " srtt=" << static_cast<uint64_t>(udp.srtt_ms) << "ms"
+                      << " qdelay=" << static_cast<uint64_t>(udp.queuing_delay_ms) << "ms"
+                      << " retx=" << udp.retransmits << " rto=" << udp.timeouts;
+        }
+        std::cout << std::endl;
+    }
+    const auto& dht = dht_node_->get_stats();
+    std::cout << "[Stats] dht responses=" << dht.responses << " served=" << dht.requests_served
+              << " limited=" << dht.requests_limited << " shed=" << dht.requests_shed
+              << " unsolicited=" << dht.unsolicited << " sources_evicted=" << dht.sources_evicted
+              << " queued=" << dht_node_->get_queued_requests()
+              << " queue_delay=" << static_cast<uint64_t>(dht.queue_delay_ms) << "ms" << std::endl;
+    if (datagram_transport_) {
+        const auto& udp = datagram_transport_->get_stats();
+        std::cout << "[Stats] datagram sent=" << udp.packets_sent << " received=" << udp.packets_received
+                  << " rejected=" << udp.packets_rejected << " impaired=" << udp.packets_impaired
+                  << " retransmits=" << udp.retransmits << std::endl;
+    }
+    const auto& cache = file_sharer_.get_chunk_cache().get_stats();
+    uint64_t lookups = cache.hits + cache.misses;
+    std::cout << "[Stats] chunk cache hits=" << cache.hits << " misses=" << cache.misses
+              << " hit_ratio=" << (lookups ? cache.hits * 100 / lookups : 0) << "%"
+              << " admitted=" << cache.admitted << " rejected=" << cache.rejected
+              << " evictions=" << cache.evictions
+              << " size=" << cache.bytes / 1024 << "KB/" << file_sharer_.get_chunk_cache().get_budget() / 1024 << "KB"
+              << std::endl;
+    const auto& verify = chunk_verifier_->get_stats();
+    std::cout << "[Stats] verifier verified=" << verify.verified << " failed=" << verify.failed
+              << " pending=" << chunk_verifier_->get_pending() << " stalls=" << verify.stalls << std::endl;
+    if (chunk_compressor_.get_level() > 0) {
+        std::cout << "[Stats] compressor level=" << chunk_compressor_.get_level()
+                  << " cache_hits=" << chunk_compressor_.get_cache_hits()
+                  << " skipped=" << chunk_compressor_.get_skipped() << std::endl;
+    }
+    auto alloc = BufferPool::instance().get_stats();
+    std::cout << "[Stats] buffers acquired=" << alloc.buffers_acquired
+              << " reused=" << alloc.buffers_reused
+              << " allocated=" << alloc.buffers_allocated
+              << " oversize=" << alloc.buffers_oversize
+              << " freed=" << alloc.buffers_freed
+              << " parsed=" << alloc.messages_parsed
+              << " arena_avg=" << (alloc.messages_parsed ? alloc.arena_bytes / alloc.messages_parsed : 0) << "B"
+              << std::endl;
 }
 
 void Node::listen(short port) {
@@ -52,7 +325,12 @@ void Node::listen(short port) {
     do_accept();
 }
 
-void Node::announce_file(const std::string& file_path) {
+void Node::announce_file(const std::string& path) {
+    // "dir/" and "dir" are the same share, with metadata in dir.aura
+    std::string file_path = path;
+    while (file_path.size() > 1 && file_path.back() == '/') {
+        file_path.pop_back();
+    }
     if (file_sharer_.share_file(file_path, *this)) {
         FileInfo file_info = file_sharer_.load_metadata(file_path + ".aura");
         if (file_info.file_hash.empty()) {
@@ -65,64 +343,219 @@ void Node::announce_file(const std::string& file_path) {
 
         std::cout << "Announcing file " << file_path << " with hash " << dht::to_hex(file_hash_str) << std::endl;
 
-        // Announce ourselves as a provider for this file in the DHT
-        PeerInfo self_info;
-        self_info.set_address("127.0.0.1"); // TODO: Determine our external IP
-        self_info.set_port(self_tcp_port_);
-        self_info.set_peer_id(peer_id_);
-        dht_node_->store_value(file_hash_str, self_info);
+        announce_provider(file_hash_str);
+    }
+}
+
+void Node::announce_provider(const std::string& file_hash) {
+    // Announce ourselves as a provider for this file in the DHT
+    PeerInfo self_info;
+    self_info.set_address("127.0.0.1"); // TODO: Determine our external IP
+    self_info.set_port(self_tcp_port_);
+    self_info.set_peer_id(peer_id_);
+    dht_node_->store_value(file_hash, self_info);
+    if (local_discovery_) {
+        local_discovery_->announce({file_hash});
+    }
+}
+
+const FileInfo* Node::find_file(const std::string& file_hash) const {
+    auto it = available_files_.find(file_hash);
+    if (it != available_files_.end()) {
+        return &it->second;
+    }
+    auto download = downloads_.find(file_hash);
+    if (download != downloads_.end() && download->second->has_metadata()) {
+        return &download->second->get_file_info();
+    }
+    return nullptr;
+}
+
+bool Node::has_chunk(const std::string& file_hash, uint32_t chunk_index) const {
+    auto it = available_files_.find(file_hash);
+    if (it != available_files_.end()) {
+        return chunk_index < it->second.chunk_hashes.size();
+    }
+    auto download = downloads_.find(file_hash);
+    return download != downloads_.end() && download->second->has_stored_chunk(chunk_index);
+}
+
+bool Node::fill_bitfield(const std::string& file_hash, Bitfield* bitfield) const {
+    auto it = available_files_.find(file_hash);
+    if (it != available_files_.end()) {
+        size_t chunks = it->second.chunk_hashes.size();
+        std::string bits((chunks + 7) / 8, '\xff');
+        if (chunks % 8) {
+            bits.back() = static_cast<char>(0xff << (8 - chunks % 8));
+        }
+        bitfield->set_file_hash(file_hash);
+        bitfield->set_bits(bits);
+        return true;
+    }
+    auto download = downloads_.find(file_hash);
+    if (download == downloads_.end()) {
+        return false;
+    }
+    download->second->fill_bitfield(bitfield);
+    return true;
+}
+
+void Node::on_chunk_stored(const std::string& file_hash, uint32_t chunk_index, bool first_chunk) {
+    if (first_chunk) {
+        std::cout << "[Download] Serving " << dht::to_hex(file_hash) << " as a partial provider." << std::endl;
+        announce_provider(file_hash);
+    }
+    for (const auto& session : sessions_) {
+        session->send_have(file_hash, chunk_index);
     }
 }
 
-void Node::download_file(const std::string& file_hash_hex) {
+void Node::download_file(const std::string& file_hash_hex, StreamHandler stream_handler, size_t stream_window) {
     std::string file_hash = dht::from_hex(file_hash_hex);
     if (file_hash.length() != 20) {
         std::cerr << "Invalid file hash format." << std::endl;
         return;
     }
+    if (downloads_.count(file_hash)) {
+        std::cout << "File " << file_hash_hex << " is already being downloaded." << std::endl;
+        return;
+    }
+
+    auto download = std::make_shared<Download>(*this, file_hash, file_hash_hex);
+    if (stream_handler) {
+        download->set_stream_handler(std::move(stream_handler), stream_window);
+    }
+    downloads_[file_hash] = download;
 
     std::cout << "Looking for peers with file hash: " << file_hash_hex << std::endl;
 
-    dht_node_->find_value(file_hash, [this](const std::vector<PeerInfo>& providers) {
-        if (providers.empty()) {
-            std::cout << "No providers found for this file." << std::endl;
-            return;
+    // The DHT lookup and a short wait for LAN answers run side by side
+    struct ProviderLookup {
+        int pending = 1;
+        std::vector<PeerInfo> dht_providers;
+    };
+    auto lookup = std::make_shared<ProviderLookup>();
+    if (local_discovery_) {
+        ++lookup->pending;
+        local_discovery_->query(file_hash);
+        auto timer = std::make_shared<boost::asio::steady_timer>(io_context_, LSD_QUERY_WAIT);
+        timer->async_wait([this, download, lookup, timer](const boost::system::error_code&) {
+            if (--lookup->pending == 0) {
+                start_download(download, lookup->dht_providers);
+            }
+        });
+    }
+    dht_node_->find_value(file_hash, [this, download, lookup](const std::vector<PeerInfo>& providers) {
+        lookup->dht_providers = providers;
+        if (--lookup->pending == 0) {
+            start_download(download, lookup->dht_providers);
         }
-
-        std::cout << "Found " << providers.size() << " provider(s). Connecting to the first one..." << std::endl;
-        const auto& first_provider = providers[0];
-        
-        // TODO: Download logic should be here.
-        // For now, just connect to the first found peer.
-        connect(first_provider.address(), std::to_string(first_provider.port()));
     });
 }
 
+void Node::start_download(std::shared_ptr<Download> download, const std::vector<PeerInfo>& dht_providers) {
+    download->set_started();
+    // LAN providers go first; the DHT usually lists them as well
+    std::vector<PeerInfo> providers;
+    if (local_discovery_) {
+        providers = local_discovery_->get_providers(download->get_file_hash());
+    }
+    size_t local_count = providers.size();
+    for (const auto& provider : dht_providers) {
+        if (std::none_of(providers.begin(), providers.end(),
+                         [&](const PeerInfo& p) { return p.peer_id() == provider.peer_id(); })) {
+            providers.push_back(provider);
+        }
+    }
+
+    std::vector<const PeerInfo*> candidates;
+    std::vector<PeerInfo> spares;
+    for (const auto& provider : providers) {
+        if (provider.peer_id() == peer_id_) {
+            continue;
+        }
+        if (candidates.size() + download->get_provider_count() < MAX_DOWNLOAD_PEERS) {
+            candidates.push_back(&provider);
+        } else {
+            spares.push_back(provider);
+        }
+    }
+    download->add_spare_providers(std::move(spares));
+
+    if (candidates.empty() && download->get_provider_count() == 0) {
+        std::cout << "No providers found for this file." << std::endl;
+        on_download_finished(download->get_file_hash());
+        return;
+    }
+
+    std::cout << "Found " << providers.size() << " provider(s), " << local_count << " on the LAN. Connecting to "
+              << candidates.size() << "..." << std::endl;
+    for (const auto* provider : candidates) {
+        connect_provider(download, *provider);
+    }
+    // Every connect may have failed right away
+    download->replenish_providers();
+}
+
+void Node::connect_provider(std::shared_ptr<Download> download, const PeerInfo& provider) {
+    if (!download->add_provider(provider.peer_id())) {
+        return;
+    }
+    auto session = connect(provider.address(), std::to_string(provider.port()));
+    if (session) {
+        download->add_connection(session.get(), provider.peer_id());
+        session->set_local(local_discovery_ &&
+                           local_discovery_->is_local_provider(download->get_file_hash(), provider.peer_id()));
+        session->set_download(download);
+    }
+}
+
+void Node::on_download_finished(const std::string& file_hash) {
+    downloads_.erase(file_hash);
+    if (exit_on_complete_ && downloads_.empty()) {
+        std::cout << "All downloads finished, exiting." << std::endl;
+        // Let the session shutdowns queued by the download go out first
+        boost::asio::post(io_context_, [this]() { io_context_.stop(); });
+    }
+}
 
-void Node::connect(const std::string& host, const std::string& port) {
+std::shared_ptr<Session> Node::connect(const std::string& host, const std::string& port) {
     tcp::resolver resolver(io_context_);
-    auto endpoints = resolver.resolve(host, port);
+    boost::system::error_code resolve_ec;
+    auto endpoints = resolver.resolve(host, port, resolve_ec);
+    if (resolve_ec) {
+        std::cerr << "Resolve error: " << resolve_ec.message() << std::endl;
+        return nullptr;
+    }
 
     // Create a socket and pass it to the session as an rvalue
     auto session = std::make_shared<Session>(tcp::socket(io_context_), *this, Session::Type::CLIENT);
     
     // Capture the session in the lambda to prevent it from being destroyed
     boost::asio::async_connect(session->get_socket().lowest_layer(), endpoints,
-        [this, session](const boost::system::error_code& ec, const tcp::endpoint& endpoint) {
+        [this, session, span = trace::Span::begin("net", "tcp connect")](
+            const boost::system::error_code& ec, const tcp::endpoint& endpoint) mutable {
+            span.end();
             if (!ec) {
                 std::cout << "Connection successful. Starting session..." << std::endl;
                 sessions_.insert(session);
                 session->start();
             } else {
                 std::cerr << "Connect error: " << ec.message() << std::endl;
+                session->stop();
             }
         });
+    return session;
 }
 
 void Node::do_accept() {
     acceptor_->async_accept(
         [this](boost::system::error_code ec, tcp::socket socket) {
-            if (!ec) {
+            if (!ec && !admit_inbound()) {
+                ++sessions_rejected_;
+                boost::system::error_code close_ec;
+                socket.close(close_ec);
+            } else if (!ec) {
                 std::cout << "Accepted connection. Starting session..." << std::endl;
                 auto session = std::make_shared<Session>(std::move(socket), *this, Session::Type::SERVER);
                 sessions_.insert(session);
@@ -132,9 +565,25 @@ void Node::do_accept() {
         });
 }
 
+bool Node::admit_inbound() const {
+    size_t inbound = 0;
+    size_t pending = 0;
+    for (const auto& session : sessions_) {
+        if (session->is_inbound()) {
+            ++inbound;
+            pending += session->is_ready() ? 0 : 1;
+        }
+    }
+    return inbound < max_sessions_ && pending < MAX_PENDING_HANDSHAKES;
+}
+
 void Node::remove_session(std::shared_ptr<Session> session) {
     if (sessions_.count(session)) {
         sessions_.erase(session);
+        // A freed upload slot goes to a waiting peer right away
+        if (session->is_interested() && !session->is_choked()) {
+            rechoke();
+        }
         // std::cout << "Session closed. Total sessions: " << sessions_.size() << std::endl;
     }
 }
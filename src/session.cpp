@@ -1,13 +1,82 @@
 #include "session.hpp"
 #include "node.hpp"
+#include "download.hpp"
+#include "trace.hpp"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <algorithm>
 #include <iostream>
 
 namespace aura {
 
+namespace {
+
+void write_frame_header(uint8_t* out, size_t body_size) {
+    out[0] = static_cast<uint8_t>((body_size >> 24) & 0xff);
+    out[1] = static_cast<uint8_t>((body_size >> 16) & 0xff);
+    out[2] = static_cast<uint8_t>((body_size >> 8) & 0xff);
+    out[3] = static_cast<uint8_t>(body_size & 0xff);
+}
+
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::internal::WireFormatLite;
+
+size_t bytes_field_size(size_t length) {
+    return 1 + CodedOutputStream::VarintSize32(static_cast<uint32_t>(length)) + length;
+}
+
+size_t varint_field_size(uint32_t value) {
+    return value == 0 ? 0 : 1 + CodedOutputStream::VarintSize32(value);
+}
+
+uint8_t* write_bytes_field(int field, const void* data, size_t length, uint8_t* out) {
+    out = WireFormatLite::WriteTagToArray(field, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, out);
+    out = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(length), out);
+    return CodedOutputStream::WriteRawToArray(data, static_cast<int>(length), out);
+}
+
+uint8_t* write_varint_field(int field, uint32_t value, uint8_t* out) {
+    // proto3 leaves zero scalars off the wire
+    if (value == 0) {
+        return out;
+    }
+    out = WireFormatLite::WriteTagToArray(field, WireFormatLite::WIRETYPE_VARINT, out);
+    return CodedOutputStream::WriteVarint32ToArray(value, out);
+}
+
+// Encodes a framed MessageWrapper{send_chunk} up to the payload bytes, which
+// the caller sends right after it from the shared chunk buffer. data is the
+// last field on the wire; parsers accept fields in any order.
+PooledBuffer encode_send_chunk_head(const std::string& file_hash, uint32_t chunk_index, size_t length,
+                                    Compression compression, uint32_t raw_size) {
+    size_t inner_size = bytes_field_size(file_hash.size()) + varint_field_size(chunk_index) +
+                        bytes_field_size(length) + varint_field_size(compression) + varint_field_size(raw_size);
+    size_t body_size = bytes_field_size(inner_size);
+
+    PooledBuffer head = BufferPool::instance().acquire(FRAME_HEADER_SIZE + body_size - length);
+    uint8_t* out = head.data();
+    write_frame_header(out, body_size);
+    out += FRAME_HEADER_SIZE;
+    out = WireFormatLite::WriteTagToArray(MessageWrapper::kSendChunkFieldNumber,
+                                          WireFormatLite::WIRETYPE_LENGTH_DELIMITED, out);
+    out = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(inner_size), out);
+    out = write_bytes_field(SendChunk::kFileHashFieldNumber, file_hash.data(), file_hash.size(), out);
+    out = write_varint_field(SendChunk::kChunkIndexFieldNumber, chunk_index, out);
+    out = write_varint_field(SendChunk::kCompressionFieldNumber, compression, out);
+    out = write_varint_field(SendChunk::kRawSizeFieldNumber, raw_size, out);
+    out = WireFormatLite::WriteTagToArray(SendChunk::kDataFieldNumber, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, out);
+    CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(length), out);
+    return head;
+}
+
+} // namespace
+
 // The constructor now takes the session type (client or server)
 Session::Session(tcp::socket socket, Node& node, Type type)
     : socket_(std::move(socket), node.get_ssl_context()),
       read_buffer_(4096), // 4KB read buffer
+      arena_(make_arena_options(arena_block_.data(), arena_block_.size())),
+      handshake_timer_(socket_.get_executor()),
       node_(node),
       session_type_(type) {}
 
@@ -17,6 +86,18 @@ Session::~Session() {
 }
 
 void Session::start() {
+    // A peer that stalls the handshake would hold its slot indefinitely
+    handshake_timer_.expires_after(HANDSHAKE_TIMEOUT);
+    handshake_timer_.async_wait([weak = std::weak_ptr<Session>(shared_from_this())](const boost::system::error_code& ec) {
+        auto self = weak.lock();
+        if (ec || !self || self->handshake_done_ || self->stopped_) {
+            return;
+        }
+        std::cerr << "Handshake timed out, closing session." << std::endl;
+        boost::system::error_code close_ec;
+        self->socket_.lowest_layer().close(close_ec); // Aborts a TLS handshake in progress
+        self->stop();
+    });
     // Start the SSL handshake
     do_handshake();
 }
@@ -26,6 +107,7 @@ void Session::stop() {
         return;
     }
     stopped_ = true;
+    handshake_timer_.cancel();
 
     // Gracefully shut down the SSL connection
     if (socket_.lowest_layer().is_open()) {
@@ -38,6 +120,15 @@ void Session::stop() {
         });
     }
     
+    upload_queue_.clear();
+    if (datagram_) {
+        datagram_->close();
+    }
+    if (download_) {
+        auto download = std::move(download_);
+        download->remove_peer(shared_from_this());
+    }
+
     // Remove ourselves from the active session list in Node.
     node_.remove_session(shared_from_this());
 }
@@ -50,24 +141,24 @@ void Session::do_handshake() {
                           ssl::stream_base::server;
 
     socket_.async_handshake(handshake_type,
-        [this, self](const boost::system::error_code& ec) {
+        [this, self, span = trace::Span::begin("net", "tls handshake")](const boost::system::error_code& ec) mutable {
+            span.end();
             if (!ec) {
                 std::cout << "SSL Handshake successful." << std::endl;
                 
                 // The client should send its Handshake first
                 if (session_type_ == Type::CLIENT) {
                     std::cout << "Acting as CLIENT: sending initial handshake." << std::endl;
-                    aura::MessageWrapper msg;
-                    auto* handshake = msg.mutable_handshake();
-                    handshake->set_peer_id(node_.get_peer_id());
-                    handshake->set_version(1);
-                    do_write(msg);
+                    if (auto* transport = node_.get_datagram_transport()) {
+                        datagram_ = transport->create_channel();
+                    }
+                    send_handshake();
                 } else {
                     std::cout << "Acting as SERVER: waiting for handshake." << std::endl;
                 }
 
                 // Start reading data
-                do_read();
+                do_read_header();
             } else {
                 std::cerr << "SSL Handshake failed: " << ec.message() << std::endl;
                 stop();
@@ -75,51 +166,402 @@ void Session::do_handshake() {
         });
 }
 
-void Session::do_read() {
+void Session::update_rates(double elapsed_seconds) {
+    if (elapsed_seconds <= 0) {
+        return;
+    }
+    // Exponential smoothing keeps one burst from deciding a peer's rank
+    stats_.upload_rate = 0.5 * stats_.upload_rate + 0.5 * (stats_.window_uploaded / elapsed_seconds);
+    stats_.download_rate = 0.5 * stats_.download_rate + 0.5 * (stats_.window_downloaded / elapsed_seconds);
+    stats_.window_uploaded = 0;
+    stats_.window_downloaded = 0;
+}
+
+void Session::record_rtt(std::chrono::steady_clock::duration rtt) {
+    double ms = std::chrono::duration<double, std::milli>(rtt).count();
+    stats_.rtt_ms = stats_.rtt_ms == 0 ? ms : 0.8 * stats_.rtt_ms + 0.2 * ms;
+}
+
+void Session::set_choked(bool choked) {
+    if (am_choking_ == choked || stopped_) {
+        return;
+    }
+    am_choking_ = choked;
+    if (choked) {
+        upload_queue_.clear();
+    }
+    MessageWrapper msg;
+    msg.mutable_choke()->set_choked(choked);
+    do_write(msg);
+}
+
+void Session::send_handshake() {
+    aura::MessageWrapper msg;
+    auto* handshake = msg.mutable_handshake();
+    handshake->set_peer_id(node_.get_peer_id());
+    handshake->set_version(1);
+    // We can always decode deflate, whether or not we compress ourselves
+    handshake->add_compression(COMPRESSION_DEFLATE);
+    if (datagram_) {
+        handshake->set_datagram_port(node_.get_datagram_transport()->get_port());
+        handshake->set_datagram_conn_id(datagram_->get_conn_id());
+        handshake->set_datagram_key_share(datagram_->get_key_share());
+    }
+    do_write(msg);
+}
+
+void Session::send_bitfield(const std::string& file_hash) {
+    MessageWrapper msg;
+    if (!node_.fill_bitfield(file_hash, msg.mutable_bitfield())) {
+        return; // Not a file we hold
+    }
+    bitfield_sent_.insert(file_hash);
+    do_write(msg);
+}
+
+void Session::send_have(const std::string& file_hash, uint32_t chunk_index) {
+    if (!bitfield_sent_.count(file_hash)) {
+        return;
+    }
+    MessageWrapper msg;
+    auto* have = msg.mutable_have();
+    have->set_file_hash(file_hash);
+    have->set_chunk_index(chunk_index);
+    do_write(msg);
+}
+
+void Session::do_read_header() {
     auto self(shared_from_this());
-    socket_.async_read_some(boost::asio::buffer(read_buffer_),
-        [this, self](boost::system::error_code ec, std::size_t length) {
-            if (!ec) {
-                MessageWrapper msg;
-                if (msg.ParseFromArray(read_buffer_.data(), length)) {
-                    if (msg.has_handshake()) {
-                        std::cout << "Received encrypted handshake from a peer." << std::endl;
-
-                        // If we are the server, respond to the handshake
-                        if (session_type_ == Type::SERVER) {
-                            std::cout << "Acting as SERVER: responding to handshake." << std::endl;
-                            aura::MessageWrapper response;
-                            auto* handshake = response.mutable_handshake();
-                            handshake->set_peer_id(node_.get_peer_id());
-                            handshake->set_version(1);
-                            do_write(response);
-                        }
-                    } 
-                    // ... (rest of the logic for handling announce, request_chunk, etc.)
-                } else {
-                    std::cerr << "Failed to parse message." << std::endl;
-                }
-                do_read(); // Continue reading
-            } else {
+    boost::asio::async_read(socket_, boost::asio::buffer(header_buffer_),
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            if (ec) {
                 if (ec != boost::asio::error::eof) {
                     std::cerr << "Read error: " << ec.message() << std::endl;
                 }
                 stop();
+                return;
+            }
+
+            uint32_t length = (uint32_t(header_buffer_[0]) << 24) | (uint32_t(header_buffer_[1]) << 16) |
+                              (uint32_t(header_buffer_[2]) << 8) | uint32_t(header_buffer_[3]);
+            bool metadata_expected = download_ && download_->awaits_metadata_from(this);
+            if (length > (metadata_expected ? MAX_METADATA_FRAME_SIZE : MAX_FRAME_SIZE)) {
+                std::cerr << "Frame too large (" << length << " bytes), closing session." << std::endl;
+                stop();
+                return;
             }
+            do_read_body(length);
         });
 }
 
-void Session::do_write(const MessageWrapper& msg) {
+void Session::do_read_body(uint32_t length) {
     auto self(shared_from_this());
-    // Use a shared_ptr for the buffer so it lives until the write is complete
-    auto serialized_msg = std::make_shared<std::string>();
-    msg.SerializeToString(serialized_msg.get());
+    read_buffer_.resize(length);
+    boost::asio::async_read(socket_, boost::asio::buffer(read_buffer_),
+        [this, self](boost::system::error_code ec, std::size_t length) {
+            if (ec) {
+                std::cerr << "Read error: " << ec.message() << std::endl;
+                stop();
+                return;
+            }
+
+            bool chunk = process_frame(read_buffer_.data(), length);
+            if (length > MAX_FRAME_SIZE) {
+                std::vector<uint8_t>().swap(read_buffer_); // Do not keep a large metadata buffer around
+            }
+            if (stopped_) {
+                return;
+            }
+            // Backpressure: while the verifier is saturated, leave further
+            // chunks in the socket so TCP slows the peer down
+            auto& verifier = node_.get_chunk_verifier();
+            if (chunk && !verifier.has_capacity()) {
+                verifier.wait_for_capacity([this, self]() {
+                    if (!stopped_) {
+                        do_read_header();
+                    }
+                });
+                return;
+            }
+            do_read_header(); // Continue reading
+        });
+}
+
+bool Session::process_frame(const uint8_t* data, size_t length) {
+    auto* msg = google::protobuf::Arena::CreateMessage<MessageWrapper>(&arena_);
+    bool chunk = false;
+    if (msg->ParseFromArray(data, static_cast<int>(length))) {
+        chunk = msg->has_send_chunk();
+        handle_message(*msg);
+    } else {
+        std::cerr << "Failed to parse message." << std::endl;
+    }
+    BufferPool::instance().record_arena_parse(arena_.SpaceUsed());
+    arena_.Reset();
+    return chunk;
+}
+
+void Session::start_datagram(const Handshake& handshake) {
+    boost::system::error_code ec;
+    auto address = socket_.lowest_layer().remote_endpoint(ec).address();
+    if (ec || handshake.datagram_port() == 0 || handshake.datagram_port() > 65535 ||
+        handshake.datagram_key_share().size() != DATAGRAM_KEY_SHARE_SIZE) {
+        // The peer did not take up the offer: chunks stay on TLS/TCP
+        datagram_->close();
+        datagram_.reset();
+        return;
+    }
+    std::weak_ptr<Session> weak = shared_from_this();
+    datagram_->set_frame_handler([weak](const uint8_t* data, size_t length) {
+        if (auto self = weak.lock()) {
+            self->on_datagram_frame(data, length);
+        }
+    });
+    datagram_->set_failure_handler([weak]() {
+        if (auto self = weak.lock()) {
+            self->stop();
+        }
+    });
+    datagram_->connect(udp::endpoint(address, static_cast<unsigned short>(handshake.datagram_port())),
+                       handshake.datagram_conn_id(), handshake.datagram_key_share(),
+                       session_type_ == Type::CLIENT);
+}
+
+void Session::on_datagram_frame(const uint8_t* data, size_t length) {
+    if (stopped_) {
+        return;
+    }
+    bool chunk = process_frame(data, length);
+    // Same backpressure as on TCP: the channel stops delivering and its
+    // advertised window closes until the verifier catches up
+    auto& verifier = node_.get_chunk_verifier();
+    if (chunk && !stopped_ && !verifier.has_capacity()) {
+        datagram_->pause();
+        std::weak_ptr<Session> weak = shared_from_this();
+        verifier.wait_for_capacity([weak]() {
+            auto self = weak.lock();
+            if (self && !self->stopped_ && self->datagram_) {
+                self->datagram_->resume();
+            }
+        });
+    }
+}
+
+void Session::handle_message(MessageWrapper& msg) {
+    if (msg.has_handshake()) {
+        std::cout << "Received encrypted handshake from a peer." << std::endl;
+        const auto& handshake = msg.handshake();
+        remote_peer_id_ = handshake.peer_id();
+        handshake_done_ = true;
+        handshake_timer_.cancel();
+        peer_accepts_deflate_ = std::find(handshake.compression().begin(), handshake.compression().end(),
+                                          COMPRESSION_DEFLATE) != handshake.compression().end();
+
+        // If we are the server, respond to the handshake
+        if (session_type_ == Type::SERVER) {
+            std::cout << "Acting as SERVER: responding to handshake." << std::endl;
+            auto* transport = node_.get_datagram_transport();
+            if (transport && handshake.datagram_port() != 0 && !datagram_) {
+                datagram_ = transport->create_channel();
+            }
+            send_handshake();
+        } else if (download_) {
+            // The server answered our handshake, the session is ready for requests
+            download_->add_peer(shared_from_this());
+        }
+        if (datagram_ && !datagram_->is_established()) {
+            start_datagram(handshake);
+        }
+    } else if (msg.has_request_metadata()) {
+        const FileInfo* found = node_.find_file(msg.request_metadata().file_hash());
+        if (!found) {
+            std::cerr << "Peer asked for metadata of an unknown file." << std::endl;
+            return;
+        }
+        MessageWrapper response;
+        fill_metadata(*found, response.mutable_metadata());
+        do_write(response);
+    } else if (msg.has_metadata()) {
+        if (download_) {
+            download_->handle_metadata(shared_from_this(), msg.metadata());
+        }
+    } else if (msg.has_interested()) {
+        bool interested = msg.interested().interested();
+        if (interested == peer_interested_) {
+            return;
+        }
+        peer_interested_ = interested;
+        if (interested) {
+            // May choke the peer right away when every upload slot is taken
+            node_.on_peer_interested(shared_from_this());
+        } else {
+            if (!am_choking_) {
+                set_choked(true);
+                node_.rechoke(); // Its slot goes to a waiting peer
+            }
+            upload_queue_.clear();
+        }
+    } else if (msg.has_request_chunk()) {
+        if (am_choking_) {
+            // Sent before our Choke arrived; repeat it so the peer does not wait on the request
+            MessageWrapper choke;
+            choke.mutable_choke()->set_choked(true);
+            do_write(choke);
+            return;
+        }
+        upload_queue_.push_back(msg.request_chunk());
+        serve_next_upload();
+    } else if (msg.has_cancel_chunk()) {
+        const auto& cancel = msg.cancel_chunk();
+        upload_queue_.erase(std::remove_if(upload_queue_.begin(), upload_queue_.end(), [&](const RequestChunk& r) {
+            return r.file_hash() == cancel.file_hash() && r.chunk_index() == cancel.chunk_index();
+        }), upload_queue_.end());
+    } else if (msg.has_choke()) {
+        if (download_) {
+            download_->handle_choke(shared_from_this(), msg.choke().choked());
+        }
+    } else if (msg.has_bitfield()) {
+        const auto& bitfield = msg.bitfield();
+        if (download_ && download_->get_file_hash() == bitfield.file_hash()) {
+            download_->handle_bitfield(shared_from_this(), bitfield);
+        }
+        // Answer with ours, unless this is already the answer to it
+        if (!bitfield_sent_.count(bitfield.file_hash())) {
+            send_bitfield(bitfield.file_hash());
+        }
+    } else if (msg.has_have()) {
+        if (download_ && download_->get_file_hash() == msg.have().file_hash()) {
+            download_->handle_have(shared_from_this(), msg.have().chunk_index());
+        }
+    } else if (msg.has_send_chunk()) {
+        stats_.bytes_downloaded += msg.send_chunk().data().size();
+        stats_.window_downloaded += msg.send_chunk().data().size();
+        if (download_) {
+            download_->handle_chunk(shared_from_this(), *msg.mutable_send_chunk());
+        }
+    }
+}
+
+void Session::serve_next_upload() {
+    if (!write_queue_.empty() || (datagram_ && !datagram_->send_idle())) {
+        return; // Resumed once the pending writes drain
+    }
+    while (!upload_queue_.empty() && !stopped_ && !reading_chunk_) {
+        RequestChunk req = std::move(upload_queue_.front());
+        upload_queue_.pop_front();
+
+        const FileInfo* file_info = node_.find_file(req.file_hash());
+        if (!file_info || !node_.has_chunk(req.file_hash(), req.chunk_index())) {
+            std::cerr << "Peer requested a chunk we do not have." << std::endl;
+            continue;
+        }
+
+        // The read completes on the disk backend; the session only resumes
+        // serving once the chunk has been handed to the write queue
+        reading_chunk_ = true;
+        auto self(shared_from_this());
+        node_.get_file_sharer().async_get_chunk(*file_info, req.chunk_index(),
+            [this, self, req, span = trace::Span::begin("disk", "read chunk", req.chunk_index())](
+                bool ok, ChunkData data) mutable {
+                span.end();
+                if (stopped_) {
+                    return;
+                }
+                if (!ok) {
+                    reading_chunk_ = false;
+                    std::cerr << "Failed to read chunk " << req.chunk_index() << " from disk." << std::endl;
+                    serve_next_upload();
+                    return;
+                }
+                ChunkCompressor& compressor = node_.get_chunk_compressor();
+                if (!peer_accepts_deflate_ || compressor.get_level() == 0) {
+                    reading_chunk_ = false;
+                    send_chunk(req, std::move(data), nullptr);
+                    return;
+                }
+                // Deflate runs on the compressor's workers, off the io_context
+                compressor.async_compress(req.file_hash(), req.chunk_index(), data,
+                    [this, self, req, data](std::shared_ptr<const std::string> compressed) mutable {
+                        reading_chunk_ = false;
+                        if (!stopped_) {
+                            send_chunk(req, std::move(data), std::move(compressed));
+                        }
+                    });
+            });
+        return;
+    }
+}
 
-    boost::asio::async_write(socket_, boost::asio::buffer(*serialized_msg),
-        [this, self, serialized_msg](boost::system::error_code ec, std::size_t /*length*/) {
+void Session::send_chunk(const RequestChunk& req, ChunkData data, std::shared_ptr<const std::string> compressed) {
+    // The payload is shared with the cache and every other session sending it
+    OutgoingFrame frame;
+    if (compressed) {
+        frame.head = encode_send_chunk_head(req.file_hash(), req.chunk_index(), compressed->size(),
+                                            COMPRESSION_DEFLATE, static_cast<uint32_t>(data->size()));
+        frame.payload = reinterpret_cast<const uint8_t*>(compressed->data());
+        frame.payload_size = compressed->size();
+        frame.payload_owner = std::move(compressed);
+    } else {
+        frame.head = encode_send_chunk_head(req.file_hash(), req.chunk_index(), data->size(), COMPRESSION_NONE, 0);
+        frame.payload = data->data();
+        frame.payload_size = data->size();
+        frame.payload_owner = std::move(data);
+    }
+    stats_.bytes_uploaded += frame.payload_size;
+    stats_.window_uploaded += frame.payload_size;
+    if (datagram_ && datagram_->is_established()) {
+        std::weak_ptr<Session> weak = shared_from_this();
+        datagram_->send_frame(std::move(frame), [weak]() {
+            if (auto self = weak.lock()) {
+                self->serve_next_upload();
+            }
+        });
+        return;
+    }
+    enqueue_frame(std::move(frame));
+}
+
+void Session::do_write(const MessageWrapper& msg) {
+    if (stopped_) {
+        return;
+    }
+    size_t body_size = msg.ByteSizeLong();
+    PooledBuffer frame = BufferPool::instance().acquire(FRAME_HEADER_SIZE + body_size);
+    write_frame_header(frame.data(), body_size);
+    msg.SerializeWithCachedSizesToArray(frame.data() + FRAME_HEADER_SIZE);
+    enqueue_frame(OutgoingFrame{std::move(frame)});
+}
+
+void Session::enqueue_frame(OutgoingFrame frame) {
+    if (stopped_) {
+        return;
+    }
+    // The buffer stays queued until its write completes, then goes back to the pool
+    write_queue_.push_back(std::move(frame));
+    if (write_queue_.size() == 1) {
+        do_write_next();
+    }
+}
+
+void Session::do_write_next() {
+    auto self(shared_from_this());
+    const OutgoingFrame& frame = write_queue_.front();
+    std::array<boost::asio::const_buffer, 2> buffers = {
+        boost::asio::buffer(frame.head.data(), frame.head.size()),
+        boost::asio::buffer(frame.payload, frame.payload_size)};
+    boost::asio::async_write(socket_, buffers,
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
             if (ec) {
                 std::cerr << "Write error: " << ec.message() << std::endl;
+                write_queue_.clear();
                 stop(); // Stop the session on a write error
+                return;
+            }
+            write_queue_.pop_front();
+            if (!write_queue_.empty()) {
+                do_write_next();
+            } else {
+                serve_next_upload();
             }
         });
 }
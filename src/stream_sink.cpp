@@ -0,0 +1,80 @@
+#include "stream_sink.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+namespace aura {
+
+std::shared_ptr<StreamSink> StreamSink::open(boost::asio::io_context& io_context, const std::string& target) {
+    // A reader closing the pipe must show up as EPIPE, not kill the node
+    std::signal(SIGPIPE, SIG_IGN);
+
+    int fd;
+    if (target == "-") {
+        fd = ::dup(STDOUT_FILENO);
+        ::dup2(STDERR_FILENO, STDOUT_FILENO);
+    } else {
+        fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        std::cerr << "[Stream] Could not open " << target << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    return std::make_shared<StreamSink>(io_context, fd);
+}
+
+StreamSink::StreamSink(boost::asio::io_context& io_context, int fd)
+    : out_(io_context, fd) {}
+
+StreamHandler StreamSink::handler() {
+    auto self = shared_from_this();
+    return [self](ChunkData chunk, std::function<void()> consumed) {
+        self->on_chunk(std::move(chunk), std::move(consumed));
+    };
+}
+
+void StreamSink::on_chunk(ChunkData chunk, std::function<void()> consumed) {
+    if (!chunk) {
+        ended_ = true;
+    } else if (broken_) {
+        consumed();
+        return;
+    } else {
+        queue_.emplace_back(std::move(chunk), std::move(consumed));
+    }
+    write_next();
+}
+
+void StreamSink::write_next() {
+    if (writing_) {
+        return;
+    }
+    if (queue_.empty()) {
+        if (ended_ && out_.is_open()) {
+            boost::system::error_code ec;
+            out_.close(ec);
+        }
+        return;
+    }
+    writing_ = true;
+    auto self = shared_from_this();
+    const auto& chunk = *queue_.front().first;
+    boost::asio::async_write(out_, boost::asio::buffer(chunk.data(), chunk.size()),
+        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+            writing_ = false;
+            if (ec && !broken_) {
+                std::cerr << "[Stream] Write failed: " << ec.message() << ", dropping the rest of the stream."
+                          << std::endl;
+                broken_ = true;
+            }
+            auto consumed = std::move(queue_.front().second);
+            queue_.pop_front();
+            consumed();
+            write_next();
+        });
+}
+
+} // namespace aura
@@ -0,0 +1,126 @@
+#include "trace.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <unistd.h>
+#include <vector>
+
+namespace aura {
+namespace trace {
+
+std::atomic<bool> g_enabled{false};
+
+namespace {
+
+struct Event {
+    const char* category;
+    const char* name;
+    int64_t arg;
+    uint64_t start_us;
+    uint64_t end_us;
+    uint64_t id;
+    const char* outcome; // Null for a span that completed
+};
+
+std::mutex g_mutex;
+std::vector<Event> g_events;
+std::string g_path;
+uint64_t g_next_id = 1;
+uint64_t g_dropped = 0;
+
+uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void write_event(std::ostream& out, const Event& event, char phase, uint64_t ts, int pid) {
+    out << "{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\",\"ph\":\"" << phase
+        << "\",\"id\":" << event.id << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << pid;
+    if (phase == 'b' && event.arg >= 0) {
+        out << ",\"args\":{\"index\":" << event.arg << "}";
+    }
+    if (phase == 'e' && event.outcome) {
+        out << ",\"args\":{\"outcome\":\"" << event.outcome << "\"}";
+    }
+    out << "}";
+}
+
+} // namespace
+
+void start(const std::string& path) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_enabled) {
+        return;
+    }
+    g_path = path;
+    g_events.clear();
+    g_dropped = 0;
+    g_enabled = true;
+    std::cout << "[Trace] Recording to " << path << std::endl;
+}
+
+void stop() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (!g_enabled) {
+        return;
+    }
+    g_enabled = false;
+
+    std::ofstream out(g_path);
+    if (!out) {
+        std::cerr << "[Trace] Could not write " << g_path << std::endl;
+        return;
+    }
+    // Async begin/end pairs: spans overlap freely, unlike complete events
+    int pid = static_cast<int>(::getpid());
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < g_events.size(); ++i) {
+        const Event& event = g_events[i];
+        write_event(out, event, 'b', event.start_us, pid);
+        out << ",\n";
+        write_event(out, event, 'e', event.end_us, pid);
+        out << (i + 1 < g_events.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    std::cout << "[Trace] Wrote " << g_events.size() << " span(s) to " << g_path
+              << (g_dropped ? " (" + std::to_string(g_dropped) + " dropped)" : std::string()) << std::endl;
+    g_events.clear();
+    g_events.shrink_to_fit();
+}
+
+void toggle(const std::string& path) {
+    if (enabled()) {
+        stop();
+    } else {
+        start(path);
+    }
+}
+
+Span::Span(const char* category, const char* name, int64_t arg)
+    : category_(category), name_(name), arg_(arg), start_us_(now_us()) {}
+
+void Span::end() {
+    end(nullptr);
+}
+
+void Span::end(const char* outcome) {
+    if (!name_) {
+        return;
+    }
+    uint64_t end_us = now_us();
+    const char* name = name_;
+    name_ = nullptr;
+    if (!enabled()) {
+        return; // Recording stopped while the span was open
+    }
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (g_events.size() >= MAX_TRACE_EVENTS) {
+        ++g_dropped;
+        return;
+    }
+    g_events.push_back({category_, name, arg_, start_us_, end_us, g_next_id++, outcome});
+}
+
+} // namespace trace
+} // namespace aura
@@ -0,0 +1,64 @@
+#include "verifier.hpp"
+#include "compression.hpp"
+#include "file_sharer.hpp"
+#include <algorithm>
+
+namespace aura {
+
+ChunkVerifier::ChunkVerifier(boost::asio::io_context& io_context, size_t threads, size_t max_pending)
+    : io_context_(io_context),
+      pool_(std::max<size_t>(threads, 1)),
+      max_pending_(std::max<size_t>(max_pending, 1)) {}
+
+ChunkVerifier::~ChunkVerifier() {
+    pool_.join();
+}
+
+void ChunkVerifier::submit(VerifyJob job, VerifyHandler handler) {
+    ++pending_;
+    boost::asio::post(pool_, [this, job = std::move(job), handler = std::move(handler)]() mutable {
+        bool ok = true;
+        std::string decompressed;
+        const std::string* raw = &job.payload;
+        if (job.compression == COMPRESSION_DEFLATE) {
+            ok = job.raw_size <= CHUNK_SIZE && deflate_decompress(job.payload, job.raw_size, decompressed);
+            raw = &decompressed;
+        } else if (job.compression != COMPRESSION_NONE) {
+            ok = false; // Unknown codec
+        }
+        // Hashes always cover the uncompressed bytes; only a good chunk is copied out
+        ok = ok && calculate_sha1(raw->data(), raw->size()) == job.expected_hash;
+        std::vector<uint8_t> data;
+        if (ok) {
+            data.assign(raw->begin(), raw->end());
+        }
+
+        boost::asio::post(io_context_, [this, ok, data = std::move(data), handler = std::move(handler)]() mutable {
+            if (ok) {
+                ++stats_.verified;
+            } else {
+                ++stats_.failed;
+            }
+            handler(ok, std::move(data));
+            on_complete();
+        });
+    });
+}
+
+void ChunkVerifier::wait_for_capacity(std::function<void()> resume) {
+    ++stats_.stalls;
+    waiting_.push_back(std::move(resume));
+}
+
+void ChunkVerifier::on_complete() {
+    --pending_;
+    // Wake as many parked readers as there are free slots
+    size_t wake = std::min(waiting_.size(), max_pending_ - std::min(pending_, max_pending_));
+    for (size_t i = 0; i < wake; ++i) {
+        auto resume = std::move(waiting_.front());
+        waiting_.pop_front();
+        resume();
+    }
+}
+
+} // namespace aura
@@ -0,0 +1,134 @@
+#include "chunk_cache.hpp"
+#include "file_sharer.hpp"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace aura {
+namespace {
+
+std::string key(uint32_t chunk_index) {
+    return ChunkCache::make_key(std::vector<uint8_t>(20, 1), chunk_index);
+}
+
+ChunkData chunk(size_t size = CHUNK_SIZE) {
+    return std::make_shared<const std::vector<uint8_t>>(size, 0);
+}
+
+// Requests a key count times, as sessions do before offering the read chunk
+void request(ChunkCache& cache, const std::string& k, int count) {
+    for (int i = 0; i < count; ++i) {
+        cache.get(k);
+    }
+}
+
+TEST(FrequencySketch, CountsAndSaturates) {
+    FrequencySketch sketch(16);
+    size_t hash = std::hash<std::string>{}("a");
+    EXPECT_EQ(sketch.estimate(hash), 0);
+    for (int i = 0; i < 3; ++i) {
+        sketch.increment(hash);
+    }
+    EXPECT_EQ(sketch.estimate(hash), 3);
+    for (int i = 0; i < 40; ++i) {
+        sketch.increment(hash);
+    }
+    EXPECT_LE(sketch.estimate(hash), SKETCH_MAX_COUNT);
+}
+
+TEST(FrequencySketch, AgesOldCounts) {
+    FrequencySketch sketch(16);
+    size_t hot = std::hash<std::string>{}("hot");
+    for (int i = 0; i < 8; ++i) {
+        sketch.increment(hot);
+    }
+    // Enough other samples to trigger at least one halving
+    for (size_t i = 0; i < 16 * SKETCH_SAMPLES_PER_ENTRY; ++i) {
+        sketch.increment(std::hash<std::string>{}(std::to_string(i)));
+    }
+    EXPECT_LT(sketch.estimate(hot), 8);
+}
+
+TEST(ChunkCache, AdmitsWhileUnderBudget) {
+    ChunkCache cache(4 * CHUNK_SIZE);
+    for (uint32_t i = 0; i < 4; ++i) {
+        request(cache, key(i), 1);
+        cache.put(key(i), chunk());
+    }
+    EXPECT_EQ(cache.get_stats().admitted, 4u);
+    EXPECT_EQ(cache.get_stats().entries, 4u);
+    EXPECT_EQ(cache.get_stats().bytes, 4 * CHUNK_SIZE);
+    EXPECT_NE(cache.get(key(0)), nullptr);
+}
+
+TEST(ChunkCache, RejectsCandidateNoMorePopularThanVictim) {
+    ChunkCache cache(2 * CHUNK_SIZE);
+    for (uint32_t i = 0; i < 2; ++i) {
+        request(cache, key(i), 3);
+        cache.put(key(i), chunk());
+    }
+    // A one-off sequential read does not flush the popular chunks
+    request(cache, key(9), 1);
+    cache.put(key(9), chunk());
+    EXPECT_EQ(cache.get_stats().rejected, 1u);
+    EXPECT_EQ(cache.get_stats().evictions, 0u);
+    EXPECT_EQ(cache.get(key(9)), nullptr);
+    EXPECT_NE(cache.get(key(0)), nullptr);
+    EXPECT_NE(cache.get(key(1)), nullptr);
+}
+
+TEST(ChunkCache, EvictsLeastRecentlyUsedForPopularCandidate) {
+    ChunkCache cache(2 * CHUNK_SIZE);
+    for (uint32_t i = 0; i < 2; ++i) {
+        request(cache, key(i), 1);
+        cache.put(key(i), chunk());
+    }
+    cache.get(key(0)); // key(1) becomes the LRU victim
+    request(cache, key(9), 4);
+    cache.put(key(9), chunk());
+    EXPECT_EQ(cache.get_stats().evictions, 1u);
+    EXPECT_NE(cache.get(key(9)), nullptr);
+    EXPECT_NE(cache.get(key(0)), nullptr);
+    EXPECT_EQ(cache.get(key(1)), nullptr);
+}
+
+TEST(ChunkCache, DecidesAgainstAllVictimsBeforeEvicting) {
+    // A full-size chunk displaces two half-size ones; the second is popular
+    ChunkCache cache(CHUNK_SIZE);
+    request(cache, key(0), 1);
+    cache.put(key(0), chunk(CHUNK_SIZE / 2));
+    request(cache, key(1), 6);
+    cache.put(key(1), chunk(CHUNK_SIZE / 2));
+
+    request(cache, key(9), 3);
+    cache.put(key(9), chunk());
+    EXPECT_EQ(cache.get_stats().rejected, 1u);
+    EXPECT_EQ(cache.get_stats().evictions, 0u);
+    EXPECT_EQ(cache.get_stats().entries, 2u);
+    EXPECT_NE(cache.get(key(0)), nullptr);
+    EXPECT_NE(cache.get(key(1)), nullptr);
+}
+
+TEST(ChunkCache, ShrinkingBudgetEvicts) {
+    ChunkCache cache(4 * CHUNK_SIZE);
+    for (uint32_t i = 0; i < 4; ++i) {
+        request(cache, key(i), 1);
+        cache.put(key(i), chunk());
+    }
+    cache.set_budget(CHUNK_SIZE);
+    EXPECT_EQ(cache.get_stats().entries, 1u);
+    EXPECT_LE(cache.get_stats().bytes, CHUNK_SIZE);
+}
+
+TEST(ChunkCache, ZeroBudgetDisablesCache) {
+    ChunkCache cache(0);
+    cache.put(key(0), chunk());
+    EXPECT_EQ(cache.get(key(0)), nullptr);
+    EXPECT_EQ(cache.get_stats().entries, 0u);
+    EXPECT_EQ(cache.get_stats().misses, 0u);
+}
+
+} // namespace
+} // namespace aura
@@ -0,0 +1,178 @@
+#include "datagram_transport.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace aura {
+namespace {
+
+// Body that fills exactly one segment once the 4-byte length prefix is added
+const size_t SEGMENT_BODY = DATAGRAM_MSS - 4;
+
+OutgoingFrame make_frame(size_t body_size, uint8_t fill) {
+    auto body = std::make_shared<std::vector<uint8_t>>(body_size);
+    for (size_t i = 0; i < body_size; ++i) {
+        (*body)[i] = static_cast<uint8_t>(fill + i);
+    }
+    OutgoingFrame frame;
+    frame.head = BufferPool::instance().acquire(4);
+    for (int i = 0; i < 4; ++i) {
+        frame.head.data()[i] = static_cast<uint8_t>(body_size >> (24 - 8 * i));
+    }
+    frame.payload = body->data();
+    frame.payload_size = body->size();
+    frame.payload_owner = std::move(body);
+    return frame;
+}
+
+// Two transports on localhost with a channel from sender to receiver
+class ChannelPair {
+public:
+    ChannelPair() : sender_transport(io_context), receiver_transport(io_context) {
+        sender_transport.start();
+        receiver_transport.start();
+        sender = sender_transport.create_channel();
+        receiver = receiver_transport.create_channel();
+        auto loopback = boost::asio::ip::make_address("127.0.0.1");
+        sender->connect({loopback, receiver_transport.get_port()}, receiver->get_conn_id(),
+                        receiver->get_key_share(), true);
+        receiver->connect({loopback, sender_transport.get_port()}, sender->get_conn_id(),
+                          sender->get_key_share(), false);
+        receiver->set_frame_handler([this](const uint8_t* body, size_t length) {
+            received.emplace_back(body, body + length);
+        });
+    }
+
+    ~ChannelPair() {
+        sender->close();
+        receiver->close();
+        io_context.poll();
+    }
+
+    bool run_until(const std::function<bool()>& done, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!done() && std::chrono::steady_clock::now() < deadline) {
+            io_context.run_for(std::chrono::milliseconds(2));
+        }
+        return done();
+    }
+
+    bool establish() {
+        return run_until([this]() { return sender->is_established() && receiver->is_established(); },
+                         std::chrono::seconds(2));
+    }
+
+    bool receive(size_t frames, std::chrono::milliseconds timeout) {
+        return run_until([this, frames]() { return received.size() >= frames; }, timeout);
+    }
+
+    void expect_received(const std::vector<std::pair<size_t, uint8_t>>& frames) {
+        ASSERT_EQ(received.size(), frames.size());
+        for (size_t i = 0; i < frames.size(); ++i) {
+            const auto& expected = make_frame(frames[i].first, frames[i].second);
+            EXPECT_EQ(received[i], std::vector<uint8_t>(expected.payload, expected.payload + expected.payload_size))
+                << "frame " << i;
+        }
+    }
+
+    boost::asio::io_context io_context;
+    DatagramTransport sender_transport;
+    DatagramTransport receiver_transport;
+    std::shared_ptr<DatagramChannel> sender;
+    std::shared_ptr<DatagramChannel> receiver;
+    std::vector<std::vector<uint8_t>> received;
+};
+
+TEST(DatagramChannel, DeliversFramesInOrder) {
+    ChannelPair pair;
+    ASSERT_TRUE(pair.establish());
+    std::vector<std::pair<size_t, uint8_t>> frames;
+    for (uint8_t i = 0; i < 40; ++i) {
+        frames.emplace_back(1 + i * 997, i);
+        pair.sender->send_frame(make_frame(frames.back().first, i), nullptr);
+    }
+    ASSERT_TRUE(pair.receive(frames.size(), std::chrono::seconds(5)));
+    pair.expect_received(frames);
+    EXPECT_EQ(pair.sender->get_stats().retransmits, 0u);
+    EXPECT_EQ(pair.sender->get_stats().timeouts, 0u);
+}
+
+TEST(DatagramChannel, RepairsLossFromSelectiveAcks) {
+    ChannelPair pair;
+    ASSERT_TRUE(pair.establish());
+    // The first segment is dropped; the three after it are selectively
+    // acknowledged, which marks it lost well before the timeout
+    pair.sender_transport.set_impairment(1.0, std::chrono::milliseconds(0));
+    pair.sender->send_frame(make_frame(SEGMENT_BODY, 0), nullptr);
+    pair.sender_transport.set_impairment(0, std::chrono::milliseconds(0));
+    for (uint8_t i = 1; i <= DATAGRAM_DUP_THRESHOLD; ++i) {
+        pair.sender->send_frame(make_frame(SEGMENT_BODY, i), nullptr);
+    }
+
+    ASSERT_TRUE(pair.receive(4, DATAGRAM_MIN_RTO));
+    pair.expect_received({{SEGMENT_BODY, 0}, {SEGMENT_BODY, 1}, {SEGMENT_BODY, 2}, {SEGMENT_BODY, 3}});
+    EXPECT_EQ(pair.sender->get_stats().retransmits, 1u);
+    EXPECT_EQ(pair.sender->get_stats().timeouts, 0u);
+}
+
+TEST(DatagramChannel, KeepsSegmentWithTooFewLaterAcks) {
+    ChannelPair pair;
+    ASSERT_TRUE(pair.establish());
+    // Only two later segments arrive, below the duplicate threshold, so the
+    // first one waits for the retransmission timeout
+    pair.sender_transport.set_impairment(1.0, std::chrono::milliseconds(0));
+    pair.sender->send_frame(make_frame(SEGMENT_BODY, 0), nullptr);
+    pair.sender_transport.set_impairment(0, std::chrono::milliseconds(0));
+    for (uint8_t i = 1; i < DATAGRAM_DUP_THRESHOLD; ++i) {
+        pair.sender->send_frame(make_frame(SEGMENT_BODY, i), nullptr);
+    }
+
+    pair.run_until([]() { return false; }, DATAGRAM_MIN_RTO / 2);
+    EXPECT_TRUE(pair.received.empty());
+    EXPECT_EQ(pair.sender->get_stats().retransmits, 0u);
+    ASSERT_TRUE(pair.receive(3, DATAGRAM_MAX_RTO));
+    EXPECT_EQ(pair.sender->get_stats().timeouts, 1u);
+}
+
+TEST(DatagramChannel, RetransmitsAfterTimeout) {
+    ChannelPair pair;
+    ASSERT_TRUE(pair.establish());
+    // Nothing gets through, so no acknowledgement can report the loss
+    pair.sender_transport.set_impairment(1.0, std::chrono::milliseconds(0));
+    for (uint8_t i = 0; i < 3; ++i) {
+        pair.sender->send_frame(make_frame(SEGMENT_BODY, i), nullptr);
+    }
+    pair.sender_transport.set_impairment(0, std::chrono::milliseconds(0));
+    auto start = std::chrono::steady_clock::now();
+
+    ASSERT_TRUE(pair.receive(3, DATAGRAM_MAX_RTO));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, DATAGRAM_MIN_RTO);
+    pair.expect_received({{SEGMENT_BODY, 0}, {SEGMENT_BODY, 1}, {SEGMENT_BODY, 2}});
+    auto stats = pair.sender->get_stats();
+    EXPECT_EQ(stats.timeouts, 1u);
+    EXPECT_EQ(stats.retransmits, 3u);
+    // The timeout restarts from the minimum window
+    EXPECT_LE(stats.cwnd, LEDBAT_INIT_CWND);
+}
+
+TEST(DatagramChannel, DeliversUnderRandomLossBothWays) {
+    ChannelPair pair;
+    ASSERT_TRUE(pair.establish());
+    pair.sender_transport.set_impairment(0.1, std::chrono::milliseconds(0));
+    pair.receiver_transport.set_impairment(0.1, std::chrono::milliseconds(0));
+    std::vector<std::pair<size_t, uint8_t>> frames;
+    for (uint8_t i = 0; i < 20; ++i) {
+        frames.emplace_back(16 * 1024 + i, i);
+        pair.sender->send_frame(make_frame(frames.back().first, i), nullptr);
+    }
+    ASSERT_TRUE(pair.receive(frames.size(), std::chrono::seconds(10)));
+    pair.expect_received(frames);
+    EXPECT_GT(pair.sender->get_stats().retransmits, 0u);
+}
+
+} // namespace
+} // namespace aura
@@ -0,0 +1,147 @@
+#include "dht.hpp"
+#include "aura/dht_utils.hpp"
+#include "aura.pb.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace aura {
+namespace {
+
+std::string make_id(uint8_t seed) {
+    std::string id(dht::NODE_ID_SIZE, '\0');
+    for (size_t i = 0; i < id.size(); ++i) {
+        id[i] = static_cast<char>(seed + i);
+    }
+    return id;
+}
+
+DhtNode::StoredProvider make_provider(uint8_t seed, bool ipv6 = false) {
+    DhtNode::StoredProvider stored;
+    std::string address = ipv6 ? "2001:db8::" + std::to_string(seed) : "10.0.0." + std::to_string(seed);
+    stored.info.set_address(address);
+    stored.info.set_port(6000 + seed);
+    stored.info.set_peer_id(make_id(seed));
+    stored.compact = dht::encode_compact_node(stored.info.peer_id(), boost::asio::ip::make_address(address),
+                                              static_cast<uint16_t>(stored.info.port()));
+    return stored;
+}
+
+// Decodes every part and checks its size and numbering
+std::vector<PeerInfo> unpack(const std::vector<MessageWrapper>& parts) {
+    std::vector<PeerInfo> providers;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        EXPECT_LE(parts[i].ByteSizeLong(), MAX_DATAGRAM_PAYLOAD);
+        const auto& res = parts[i].find_value_res();
+        EXPECT_EQ(res.part(), i);
+        EXPECT_EQ(res.total_parts(), parts.size());
+        for (auto& info : DhtNode::decode_providers(res.providers())) {
+            providers.push_back(std::move(info));
+        }
+    }
+    return providers;
+}
+
+TEST(CompactNode, RoundTripsIpv4AndIpv6) {
+    for (const char* text : {"192.0.2.7", "2001:db8::1"}) {
+        auto address = boost::asio::ip::make_address(text);
+        std::string entry = dht::encode_compact_node(make_id(1), address, 0xBEEF);
+        EXPECT_EQ(entry.size(), address.is_v4() ? dht::COMPACT_IPV4_SIZE : dht::COMPACT_IPV6_SIZE);
+
+        std::string id;
+        boost::asio::ip::address decoded;
+        uint16_t port = 0;
+        ASSERT_TRUE(dht::decode_compact_node(entry, id, decoded, port));
+        EXPECT_EQ(id, make_id(1));
+        EXPECT_EQ(decoded, address);
+        EXPECT_EQ(port, 0xBEEF);
+    }
+}
+
+TEST(CompactNode, RejectsWrongSize) {
+    std::string entry = dht::encode_compact_node(make_id(1), boost::asio::ip::make_address("192.0.2.7"), 80);
+    std::string id;
+    boost::asio::ip::address address;
+    uint16_t port = 0;
+    EXPECT_FALSE(dht::decode_compact_node(entry.substr(1), id, address, port));
+    EXPECT_FALSE(dht::decode_compact_node(entry + "x", id, address, port));
+    EXPECT_FALSE(dht::decode_compact_node("", id, address, port));
+}
+
+TEST(DhtNeighbors, RoundTripsBothVersions) {
+    std::vector<DhtPeer> peers = {
+        {make_id(1), {boost::asio::ip::make_address("192.0.2.1"), 4000}},
+        {make_id(2), {boost::asio::ip::make_address("2001:db8::2"), 4001}},
+    };
+    for (uint32_t version : {1u, 2u}) {
+        FindNodeResponse res;
+        DhtNode::add_neighbors(&res, peers, version);
+        EXPECT_EQ(res.compact_neighbors_size(), version >= 2 ? 2 : 0);
+        auto decoded = DhtNode::decode_neighbors(res);
+        ASSERT_EQ(decoded.size(), peers.size());
+        for (size_t i = 0; i < peers.size(); ++i) {
+            EXPECT_EQ(decoded[i].id, peers[i].id);
+            EXPECT_EQ(decoded[i].endpoint, peers[i].endpoint);
+        }
+    }
+}
+
+TEST(DhtProviders, DecodesMixedEncodings) {
+    PeerList list;
+    *list.add_peers() = make_provider(1).info;
+    list.add_compact_peers(make_provider(2, true).compact);
+    list.add_compact_peers("truncated");
+    auto providers = DhtNode::decode_providers(list);
+    ASSERT_EQ(providers.size(), 2u);
+    EXPECT_EQ(providers[0].address(), "10.0.0.1");
+    EXPECT_EQ(providers[1].address(), "2001:db8::2");
+    EXPECT_EQ(providers[1].port(), 6002u);
+    EXPECT_EQ(providers[1].peer_id(), make_id(2));
+}
+
+TEST(DhtProviders, PacksIntoDatagrams) {
+    std::vector<DhtNode::StoredProvider> stored;
+    for (uint8_t i = 1; i <= 200; ++i) {
+        stored.push_back(make_provider(i, i % 3 == 0));
+    }
+    for (uint32_t version : {1u, 2u}) {
+        auto parts = DhtNode::pack_providers(make_id(9), make_id(10), stored, version);
+        EXPECT_GT(parts.size(), 1u);
+        auto providers = unpack(parts);
+        ASSERT_EQ(providers.size(), stored.size());
+        for (size_t i = 0; i < stored.size(); ++i) {
+            EXPECT_EQ(providers[i].address(), stored[i].info.address());
+            EXPECT_EQ(providers[i].port(), stored[i].info.port());
+            EXPECT_EQ(providers[i].peer_id(), stored[i].info.peer_id());
+        }
+    }
+}
+
+TEST(DhtProviders, CompactEncodingNeedsFewerDatagrams) {
+    std::vector<DhtNode::StoredProvider> stored;
+    for (uint8_t i = 1; i <= 100; ++i) {
+        stored.push_back(make_provider(i));
+    }
+    auto v1 = DhtNode::pack_providers(make_id(9), make_id(10), stored, 1);
+    auto v2 = DhtNode::pack_providers(make_id(9), make_id(10), stored, 2);
+    EXPECT_LT(v2.size(), v1.size());
+}
+
+TEST(DhtProviders, FallsBackForUnencodableEntries) {
+    auto stored = make_provider(1);
+    stored.compact.clear();
+    auto parts = DhtNode::pack_providers(make_id(9), make_id(10), {stored}, 2);
+    ASSERT_EQ(parts.size(), 1u);
+    EXPECT_EQ(parts[0].find_value_res().providers().peers_size(), 1);
+    EXPECT_EQ(unpack(parts).size(), 1u);
+}
+
+TEST(DhtProviders, EmptyListIsOnePart) {
+    auto parts = DhtNode::pack_providers(make_id(9), make_id(10), {}, 2);
+    ASSERT_EQ(parts.size(), 1u);
+    EXPECT_TRUE(unpack(parts).empty());
+}
+
+} // namespace
+} // namespace aura
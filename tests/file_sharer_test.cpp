@@ -0,0 +1,176 @@
+#include "file_sharer.hpp"
+#include "aura.pb.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace aura {
+namespace {
+
+// A directory share with placeholder chunk hashes and a matching root hash
+FileInfo make_directory(const std::vector<std::pair<std::string, uint64_t>>& files) {
+    FileInfo info;
+    info.file_path = "share";
+    info.file_size = 0;
+    for (const auto& file : files) {
+        info.files.push_back({file.first, file.second, info.file_size});
+        info.file_size += file.second;
+    }
+    uint64_t chunks = (info.file_size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    for (uint64_t i = 0; i < chunks; ++i) {
+        info.chunk_hashes.push_back(std::vector<uint8_t>(20, static_cast<uint8_t>(i)));
+    }
+    info.file_hash = manifest_root_hash(info);
+    return info;
+}
+
+Metadata to_metadata(const FileInfo& info) {
+    Metadata metadata;
+    fill_metadata(info, &metadata);
+    return metadata;
+}
+
+TEST(IsSafePath, AcceptsRelativePaths) {
+    EXPECT_TRUE(is_safe_path("a"));
+    EXPECT_TRUE(is_safe_path("a.txt"));
+    EXPECT_TRUE(is_safe_path("dir/sub/file.bin"));
+    EXPECT_TRUE(is_safe_path("..hidden/.config"));
+}
+
+TEST(IsSafePath, RejectsEscapesAndOddComponents) {
+    EXPECT_FALSE(is_safe_path(""));
+    EXPECT_FALSE(is_safe_path("/etc/passwd"));
+    EXPECT_FALSE(is_safe_path(".."));
+    EXPECT_FALSE(is_safe_path("../x"));
+    EXPECT_FALSE(is_safe_path("a/../../x"));
+    EXPECT_FALSE(is_safe_path("."));
+    EXPECT_FALSE(is_safe_path("a/./b"));
+    EXPECT_FALSE(is_safe_path("a//b"));
+    EXPECT_FALSE(is_safe_path("a/"));
+    EXPECT_FALSE(is_safe_path(std::string("a\0b", 3)));
+}
+
+TEST(ReadMetadata, RoundTripsDirectoryShare) {
+    FileInfo info = make_directory({{"a", 100}, {"b/c", CHUNK_SIZE}, {"d", 0}});
+    FileInfo parsed;
+    parsed.file_path = "out";
+    ASSERT_TRUE(read_metadata(to_metadata(info), &parsed));
+    EXPECT_EQ(parsed.file_path, "out");
+    EXPECT_EQ(parsed.file_size, 100 + CHUNK_SIZE);
+    ASSERT_EQ(parsed.files.size(), 3u);
+    EXPECT_EQ(parsed.files[1].path, "b/c");
+    EXPECT_EQ(parsed.files[1].offset, 100u);
+    EXPECT_EQ(parsed.files[2].offset, 100u + CHUNK_SIZE);
+    EXPECT_EQ(parsed.chunk_hashes, info.chunk_hashes);
+}
+
+TEST(ReadMetadata, AcceptsSingleFile) {
+    FileInfo info;
+    info.file_hash.assign(20, 7);
+    info.file_size = CHUNK_SIZE + 1;
+    info.chunk_hashes.assign(2, std::vector<uint8_t>(20, 1));
+    FileInfo parsed;
+    ASSERT_TRUE(read_metadata(to_metadata(info), &parsed));
+    EXPECT_TRUE(parsed.files.empty());
+    EXPECT_EQ(parsed.file_size, CHUNK_SIZE + 1u);
+}
+
+TEST(ReadMetadata, RejectsWrongChunkCount) {
+    Metadata metadata = to_metadata(make_directory({{"a", CHUNK_SIZE + 1}}));
+    metadata.mutable_chunk_hashes()->RemoveLast();
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(metadata, &parsed));
+}
+
+TEST(ReadMetadata, RejectsUnsortedPaths) {
+    // The root hash matches, only the order is wrong
+    FileInfo info = make_directory({{"b", 10}, {"a", 10}});
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(to_metadata(info), &parsed));
+}
+
+TEST(ReadMetadata, RejectsDuplicatePaths) {
+    FileInfo info = make_directory({{"a", 10}, {"a", 10}});
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(to_metadata(info), &parsed));
+}
+
+TEST(ReadMetadata, RejectsUnsafePaths) {
+    FileInfo info = make_directory({{"../a", 10}});
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(to_metadata(info), &parsed));
+}
+
+TEST(ReadMetadata, RejectsSizeOverflow) {
+    // Sizes wrap around to the declared total
+    Metadata metadata = to_metadata(make_directory({{"a", 10}, {"b", 10}}));
+    metadata.mutable_files(0)->set_size(std::numeric_limits<uint64_t>::max());
+    metadata.mutable_files(1)->set_size(21);
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(metadata, &parsed));
+}
+
+TEST(ReadMetadata, RejectsSizesNotCoveringTheShare) {
+    Metadata metadata = to_metadata(make_directory({{"a", 10}, {"b", 10}}));
+    metadata.mutable_files(1)->set_size(5);
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(metadata, &parsed));
+}
+
+TEST(ReadMetadata, RejectsRootHashMismatch) {
+    Metadata metadata = to_metadata(make_directory({{"a", 10}, {"b", 10}}));
+    std::string hash = metadata.chunk_hashes(0);
+    hash[0] ^= 1;
+    metadata.set_chunk_hashes(0, hash);
+    FileInfo parsed;
+    EXPECT_FALSE(read_metadata(metadata, &parsed));
+}
+
+TEST(ChunkSegments, SingleFile) {
+    FileInfo info;
+    info.file_path = "f.bin";
+    info.file_size = CHUNK_SIZE + 10;
+
+    auto first = chunk_segments(info, 0);
+    ASSERT_EQ(first.size(), 1u);
+    EXPECT_EQ(first[0].path, "f.bin");
+    EXPECT_EQ(first[0].file_offset, 0u);
+    EXPECT_EQ(first[0].length, CHUNK_SIZE);
+
+    auto last = chunk_segments(info, 1);
+    ASSERT_EQ(last.size(), 1u);
+    EXPECT_EQ(last[0].file_offset, CHUNK_SIZE);
+    EXPECT_EQ(last[0].chunk_offset, 0u);
+    EXPECT_EQ(last[0].length, 10u);
+}
+
+TEST(ChunkSegments, SpansFilesAndSkipsEmptyOnes) {
+    FileInfo info = make_directory({{"a", 100}, {"empty", 0}, {"b", CHUNK_SIZE}, {"c", 50}});
+
+    auto first = chunk_segments(info, 0);
+    ASSERT_EQ(first.size(), 2u);
+    EXPECT_EQ(first[0].path, "share/a");
+    EXPECT_EQ(first[0].file_offset, 0u);
+    EXPECT_EQ(first[0].chunk_offset, 0u);
+    EXPECT_EQ(first[0].length, 100u);
+    EXPECT_EQ(first[1].path, "share/b");
+    EXPECT_EQ(first[1].file_offset, 0u);
+    EXPECT_EQ(first[1].chunk_offset, 100u);
+    EXPECT_EQ(first[1].length, CHUNK_SIZE - 100);
+
+    auto second = chunk_segments(info, 1);
+    ASSERT_EQ(second.size(), 2u);
+    EXPECT_EQ(second[0].path, "share/b");
+    EXPECT_EQ(second[0].file_offset, CHUNK_SIZE - 100);
+    EXPECT_EQ(second[0].chunk_offset, 0u);
+    EXPECT_EQ(second[0].length, 100u);
+    EXPECT_EQ(second[1].path, "share/c");
+    EXPECT_EQ(second[1].file_offset, 0u);
+    EXPECT_EQ(second[1].chunk_offset, 100u);
+    EXPECT_EQ(second[1].length, 50u);
+}
+
+} // namespace
+} // namespace aura